@@ -0,0 +1,104 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+// Bump allocator owned by a builder for its large per-vertex tables.
+// Memory comes in chunks of whole 2 MiB pages, mapped anonymously,
+// aligned to 2 MiB and marked MADV_HUGEPAGE, so with transparent huge
+// pages ("always" or "madvise") one fault maps 2 MiB instead of 4 KiB.
+// With explicitHuge, MAP_HUGETLB (the reserved hugetlbfs pool) is tried
+// first and plain pages are the fallback when the pool is too small.
+//
+// Pages are only touched by whoever writes them first, so a table filled
+// by the OpenMP threads that later read it lands on their NUMA nodes.
+// Nothing is freed on its own: the destructor unmaps every chunk, which
+// makes teardown a few munmap calls instead of one free per table.
+//
+// Tables that start on 2 MiB boundaries put row i of each at the same
+// physical offset, so loops walking two of them side by side keep hitting
+// the same cache sets (3x slower initTables at n = 10). Every large
+// allocation is therefore started a different number of kColour steps in.
+class Arena {
+public:
+    static constexpr size_t kHugePage = size_t(2) << 20;
+    static constexpr size_t kChunk = size_t(64) << 20;    // smallest mapping
+    static constexpr size_t kAlign = 64;                  // kCacheLine
+    static constexpr size_t kColour = 4096 + kAlign;      // skew step of large tables
+    static constexpr size_t kColours = 16;
+
+    explicit Arena(bool explicitHuge = false) : explicitHuge_(explicitHuge) {}
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // bytes of uninitialized, kAlign-aligned memory
+    void* allocate(size_t bytes) {
+        bytes = (bytes + kAlign - 1) & ~(kAlign - 1);
+        size_t skew = bytes >= kHugePage ? (colour_++ % kColours) * kColour : 0;
+        if (chunks_.empty() || chunks_.back().size - chunks_.back().used < skew + bytes)
+            grow(skew + bytes);
+        Chunk& c = chunks_.back();
+        void* p = c.base + c.used + skew;
+        c.used += skew + bytes;
+        return p;
+    }
+    template <class T> T* allocate(size_t n) { return static_cast<T*>(allocate(n * sizeof(T))); }
+
+    size_t mappedBytes() const;      // all chunks
+    size_t hugetlbBytes() const;     // chunks from the hugetlbfs pool
+
+private:
+    struct Chunk {
+        uint8_t* base;
+        size_t size, used;
+        bool hugetlb;
+    };
+    std::vector<Chunk> chunks_;
+    bool explicitHuge_;
+    size_t colour_ = 0;                                   // large tables so far
+    void grow(size_t bytes);
+};
+
+// Standard allocator over an Arena (the heap when arena is null), for
+// tables kept in containers. Deallocation into the arena does nothing.
+// Elements are default-initialized, so resize() on a vector of plain
+// integers leaves the memory untouched for a parallel first fill.
+template <class T>
+struct ArenaAllocator {
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    Arena* arena = nullptr;
+
+    ArenaAllocator() = default;
+    explicit ArenaAllocator(Arena* a) : arena(a) {}
+    template <class U> ArenaAllocator(const ArenaAllocator<U>& o) : arena(o.arena) {}
+
+    T* allocate(size_t n) {
+        if (arena) return arena->allocate<T>(n);
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Arena::kAlign)));
+    }
+    void deallocate(T* p, size_t) {
+        if (!arena) ::operator delete(p, std::align_val_t(Arena::kAlign));
+    }
+
+    template <class U> void construct(U* p) { ::new (static_cast<void*>(p)) U; }
+    template <class U, class... Args> void construct(U* p, Args&&... args) {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template <class U> bool operator==(const ArenaAllocator<U>& o) const { return arena == o.arena; }
+    template <class U> bool operator!=(const ArenaAllocator<U>& o) const { return arena != o.arena; }
+};
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif // ARENA_HPP
@@ -0,0 +1,125 @@
+#include "async_writer.hpp"
+#include <chrono>
+#include <iostream>
+#include <cerrno>
+#include <unistd.h>
+
+static double secondsSince(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+AsyncWriter::AsyncWriter(size_t buffers, size_t bufferBytes)
+    : bufferBytes_(bufferBytes)
+    , free_(buffers < 2 ? 2 : buffers)
+{
+    thread_ = std::thread(&AsyncWriter::run, this);
+}
+
+AsyncWriter::~AsyncWriter() {
+    drain();
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stop_ = true;
+    }
+    workReady_.notify_one();
+    thread_.join();
+}
+
+std::vector<char> AsyncWriter::acquire() {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mu_);
+    bufferFree_.wait(lock, [this] { return free_ > 0; });
+    waitSeconds_ += secondsSince(start);
+    --free_;
+    std::vector<char> buf;
+    if (!pool_.empty()) {
+        buf = std::move(pool_.back());
+        pool_.pop_back();
+    }
+    lock.unlock();
+    buf.clear();
+    buf.reserve(bufferBytes_);
+    return buf;
+}
+
+void AsyncWriter::submit(int fd, off_t offset, std::vector<char>&& data) {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        queue_.push_back(Job{fd, offset, false, std::move(data)});
+    }
+    workReady_.notify_one();
+}
+
+void AsyncWriter::closeAfter(int fd) {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        queue_.push_back(Job{fd, -1, true, {}});
+    }
+    workReady_.notify_one();
+}
+
+void AsyncWriter::drain() {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mu_);
+    idle_.wait(lock, [this] { return queue_.empty() && !busy_; });
+    waitSeconds_ += secondsSince(start);
+}
+
+double AsyncWriter::busySeconds() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return busySeconds_;
+}
+
+double AsyncWriter::waitSeconds() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return waitSeconds_;
+}
+
+bool AsyncWriter::ok() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return ok_;
+}
+
+void AsyncWriter::run() {
+    std::unique_lock<std::mutex> lock(mu_);
+    for (;;) {
+        workReady_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) return;             // stop_ and nothing left
+        Job job = std::move(queue_.front());
+        queue_.pop_front();
+        busy_ = true;
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        bool good = true;
+        if (job.close) {
+            good = (::close(job.fd) == 0);
+        } else {
+            const char* p = job.data.data();
+            size_t left = job.data.size();
+            off_t offset = job.offset;
+            while (left > 0) {
+                ssize_t w = offset < 0 ? ::write(job.fd, p, left) : ::pwrite(job.fd, p, left, offset);
+                if (w < 0 && errno == EINTR) continue;
+                if (w <= 0) { good = false; break; }
+                p += w; left -= size_t(w);
+                if (offset >= 0) offset += w;
+            }
+        }
+        double spent = secondsSince(start);
+
+        lock.lock();
+        busySeconds_ += spent;
+        if (!good && ok_) {
+            ok_ = false;
+            std::cerr << "Asynchronous write failed (fd " << job.fd << ")" << std::endl;
+        }
+        if (!job.close) {
+            pool_.push_back(std::move(job.data));
+            ++free_;
+            bufferFree_.notify_one();
+        }
+        busy_ = false;
+        if (queue_.empty()) idle_.notify_all();
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef ASYNC_WRITER_HPP
+#define ASYNC_WRITER_HPP
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstddef>
+#include <sys/types.h>
+
+// Output stage with one dedicated writer thread. Producers take an empty
+// buffer from a fixed pool, fill it and queue it; the writer thread writes
+// queued buffers in order and hands them back to the pool. The pool size
+// bounds the memory in flight: acquire() blocks while every buffer is queued.
+class AsyncWriter {
+public:
+    explicit AsyncWriter(size_t buffers = 4, size_t bufferBytes = size_t(4) << 20);
+    ~AsyncWriter();
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    // Empty buffer with at least bufferBytes capacity (thread-safe)
+    std::vector<char> acquire();
+    // Write data at offset, or append when offset < 0 (thread-safe);
+    // data must come from acquire() and returns to the pool once written
+    void submit(int fd, off_t offset, std::vector<char>&& data);
+    // Close fd once every write queued before this call is done
+    void closeAfter(int fd);
+    // Block until the queue is empty and the writer idle
+    void drain();
+
+    // Seconds the writer thread spent writing
+    double busySeconds() const;
+    // Seconds producers spent blocked in acquire() and drain()
+    double waitSeconds() const;
+    bool ok() const;
+
+private:
+    struct Job {
+        int fd;
+        off_t offset;               // < 0: append
+        bool close;
+        std::vector<char> data;
+    };
+
+    void run();
+
+    size_t bufferBytes_;
+    size_t free_;                   // buffers not in the queue
+    std::vector<std::vector<char>> pool_;
+    std::deque<Job> queue_;
+    bool busy_ = false, stop_ = false, ok_ = true;
+    double busySeconds_ = 0, waitSeconds_ = 0;
+    mutable std::mutex mu_;
+    std::condition_variable workReady_, bufferFree_, idle_;
+    std::thread thread_;
+};
+
+#endif // ASYNC_WRITER_HPP
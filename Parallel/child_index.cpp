@@ -0,0 +1,95 @@
+#include "child_index.hpp"
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// In-place inclusive prefix sum, one contiguous block per thread
+static void inclusiveScan(uint32_t* a, size_t n) {
+#ifdef _OPENMP
+    std::vector<uint32_t> blockSum(omp_get_max_threads() + 1, 0);
+    #pragma omp parallel
+    {
+        int tid = omp_get_thread_num(), nt = omp_get_num_threads();
+        size_t lo = n * tid / nt, hi = n * (tid + 1) / nt;
+        uint32_t sum = 0;
+        for (size_t i = lo; i < hi; ++i) a[i] = (sum += a[i]);
+        blockSum[tid + 1] = sum;
+        #pragma omp barrier
+        uint32_t base = 0;
+        for (int k = 1; k <= tid; ++k) base += blockSum[k];
+        for (size_t i = lo; i < hi; ++i) a[i] += base;
+    }
+#else
+    uint32_t sum = 0;
+    for (size_t i = 0; i < n; ++i) a[i] = (sum += a[i]);
+#endif
+}
+
+void ChildIndex::zeroOffsets(size_t count) {
+    // resize leaves the entries uninitialized; clearing them with the same
+    // static split as the loops below first-touches each thread's share
+    offsets.resize(count + 1);
+    uint32_t* o = offsets.data();
+    #pragma omp parallel for schedule(static)
+    for (size_t p = 0; p <= count; ++p) o[p] = 0;
+}
+
+void ChildIndex::build(const uint32_t* parent, size_t count, uint32_t noParent) {
+    // histogram: offsets[p] = number of children of p
+    zeroOffsets(count);
+    #pragma omp parallel for schedule(static)
+    for (size_t v = 0; v < count; ++v) {
+        uint32_t p = parent[v];
+        if (p == noParent) continue;
+        #pragma omp atomic
+        offsets[p]++;
+    }
+
+    // offsets[p] = end of p's range; decrementing while scattering leaves
+    // it at the start of the range
+    inclusiveScan(offsets.data(), count);
+    offsets[count] = count ? offsets[count-1] : 0;
+    children.resize(offsets[count]);
+
+    #pragma omp parallel for schedule(static)
+    for (size_t v = 0; v < count; ++v) {
+        uint32_t p = parent[v];
+        if (p == noParent) continue;
+        uint32_t pos;
+        #pragma omp atomic capture
+        pos = --offsets[p];
+        children[pos] = (uint32_t)v;
+    }
+
+    // The atomic scatter leaves siblings in arbitrary order; a vertex has
+    // at most n-1 children so sorting each range is cheap
+    #pragma omp parallel for schedule(static)
+    for (size_t p = 0; p < count; ++p)
+        std::sort(children.begin() + offsets[p], children.begin() + offsets[p+1]);
+}
+
+void ChildIndex::buildFromEdges(const uint32_t* edges, size_t numEdges, size_t base, size_t count) {
+    zeroOffsets(count);
+    #pragma omp parallel for schedule(static)
+    for (size_t e = 0; e < numEdges; ++e) {
+        #pragma omp atomic
+        offsets[edges[2*e] - base]++;
+    }
+
+    inclusiveScan(offsets.data(), count);
+    offsets[count] = count ? offsets[count-1] : 0;
+    children.resize(offsets[count]);
+
+    #pragma omp parallel for schedule(static)
+    for (size_t e = 0; e < numEdges; ++e) {
+        uint32_t pos;
+        #pragma omp atomic capture
+        pos = --offsets[edges[2*e] - base];
+        children[pos] = edges[2*e + 1];
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (size_t p = 0; p < count; ++p)
+        std::sort(children.begin() + offsets[p], children.begin() + offsets[p+1]);
+}
@@ -0,0 +1,35 @@
+#ifndef CHILD_INDEX_HPP
+#define CHILD_INDEX_HPP
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "arena.hpp"
+
+// Compressed-sparse-row children of one tree: the children of vertex p
+// are children[offsets[p] .. offsets[p+1]), in ascending vertex order.
+// Both arrays come from the arena if one is given, else from the heap.
+struct ChildIndex {
+    ArenaVector<uint32_t> offsets;   // count+1 entries
+    ArenaVector<uint32_t> children;  // one entry per non-root vertex
+
+    ChildIndex() = default;
+    explicit ChildIndex(Arena* arena)
+        : offsets(ArenaAllocator<uint32_t>(arena)), children(ArenaAllocator<uint32_t>(arena)) {}
+
+    size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    const uint32_t* begin(size_t p) const { return children.data() + offsets[p]; }
+    const uint32_t* end(size_t p) const { return children.data() + offsets[p+1]; }
+    size_t degree(size_t p) const { return offsets[p+1] - offsets[p]; }
+
+    // Counting sort of a parent array; entries equal to noParent are roots
+    void build(const uint32_t* parent, size_t count, uint32_t noParent);
+    // Same from (parent, child) pairs whose parents lie in [base, base+count);
+    // vertex p is then indexed as p - base
+    void buildFromEdges(const uint32_t* edges, size_t numEdges, size_t base, size_t count);
+
+private:
+    void zeroOffsets(size_t count);          // offsets = count+1 zeros, in parallel
+};
+
+#endif // CHILD_INDEX_HPP
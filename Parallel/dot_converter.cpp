@@ -7,6 +7,9 @@
 #include <map>
 #include <set>
 #include <algorithm>
+#include <sstream>
+#include "permutation_utils.hpp"
+#include "ist_format.hpp"
 
 namespace fs = std::filesystem;
 
@@ -15,20 +18,17 @@ struct Edge {
     std::string to;
 };
 
-void formatAndConvertDot(const std::string& dotFile) {
-    // Extract the tree number from the filename
-    std::string filename = fs::path(dotFile).filename().string();
-    std::string treeNum = filename.substr(5, filename.length() - 9);
-    
+using EdgeMap = std::map<std::string, std::set<std::string>>;
+
+bool loadDotEdges(const std::string& dotFile, EdgeMap& edges) {
     // Read the DOT file
     std::ifstream inFile(dotFile);
     if (!inFile.is_open()) {
         std::cerr << "Error opening file: " << dotFile << std::endl;
-        return;
+        return false;
     }
 
     // Parse the graph
-    std::map<std::string, std::set<std::string>> edges;
     std::string line;
     bool inGraph = false;
     
@@ -65,9 +65,38 @@ void formatAndConvertDot(const std::string& dotFile) {
         }
     }
     inFile.close();
+    return true;
+}
+
+bool loadIstEdges(const std::string& istFile, EdgeMap& edges) {
+    IstReader tree;
+    if (!tree.open(istFile)) return false;
+
+    // Vertex indices back to permutation labels, as in the DOT output
+    int n = tree.n();
+    std::vector<uint8_t> p(n), c(n);
+    for (uint64_t v = 0; v < tree.count(); ++v) {
+        uint32_t par = tree.parent(v);
+        if (par == kIstNoParent) continue;
+        PermutationUtils::unrank(par, n, p.data());
+        PermutationUtils::unrank(v, n, c.data());
+        edges[PermutationUtils::toKey(p.data(), n)].insert(PermutationUtils::toKey(c.data(), n));
+    }
+    return true;
+}
+
+void formatAndConvertDot(const std::string& dotFile) {
+    // Extract the tree number from the filename (Tree_<n>_<t>.dot or .ist)
+    std::string filename = fs::path(dotFile).filename().string();
+    std::string treeNum = filename.substr(5, filename.length() - 9);
+
+    EdgeMap edges;
+    bool loaded = fs::path(dotFile).extension() == ".ist" ? loadIstEdges(dotFile, edges)
+                                                          : loadDotEdges(dotFile, edges);
+    if (!loaded) return;
 
     // Create formatted output
-    std::string tempFile = "temp_" + filename;
+    std::string tempFile = "temp_" + fs::path(filename).replace_extension(".dot").string();
     std::ofstream outFile(tempFile);
     
     // Write header
@@ -119,9 +148,9 @@ int main() {
     // Get current directory
     std::string currentDir = fs::current_path().string();
     
-    // Find all .dot files in the current directory
+    // Find all .dot and binary .ist files in the current directory
     for (const auto& entry : fs::directory_iterator(currentDir)) {
-        if (entry.path().extension() == ".dot") {
+        if (entry.path().extension() == ".dot" || entry.path().extension() == ".ist") {
             std::cout << "Converting " << entry.path().filename() << " to PNG..." << std::endl;
             formatAndConvertDot(entry.path().string());
         }
@@ -0,0 +1,178 @@
+#include "ist_format.hpp"
+#include "permutation_utils.hpp"
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+IstHeader IstHeader::make(int n, int tree, uint64_t count, uint64_t root, uint32_t flags) {
+    IstHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, "IST1", 4);
+    h.version = kIstVersion;
+    h.n = uint32_t(n);
+    h.tree = uint32_t(tree);
+    h.count = count;
+    h.root = root;
+    h.flags = flags;
+    return h;
+}
+
+bool IstHeader::valid() const {
+    if ((flags & kIstSwapCodes) && (flags & kIstHasChildIndex)) return false;
+    return std::memcmp(magic, "IST1", 4) == 0 && version == kIstVersion && n >= 2 && n <= 16;
+}
+
+uint8_t SwapCode::encode(uint64_t v, uint32_t parent, int n) {
+    if (parent == kIstNoParent) return kRoot;
+    for (int p = 0; p < n - 1; ++p) {
+        uint64_t f = PermutationUtils::factorial(n - 1 - p);
+        if (v / f != parent / f) return uint8_t(p);
+    }
+    return kRoot;  // parent == v: not a tree edge
+}
+
+void SwapCode::encodeRange(const uint32_t* parent, uint64_t first, uint64_t count, int n, uint8_t* code) {
+    for (uint64_t i = 0; i < count; ++i)
+        code[i] = encode(first + i, parent[i], n);
+}
+
+void SwapCode::pack(const uint8_t* code, uint64_t count, uint8_t* packed) {
+    for (uint64_t j = 0; j < count / 2; ++j)
+        packed[j] = uint8_t(code[2*j] | (code[2*j+1] << 4));
+}
+
+void SwapCode::decodeRange(const uint8_t* packed, uint64_t first, uint64_t count, int n, uint32_t* parent) {
+    if (count == 0) return;
+    // Walk the block in lexicographic order; each parent is one rank update
+    std::vector<uint8_t> perm(n);
+    PermutationUtils::unrank(first, n, perm.data());
+    for (uint64_t i = 0; i < count; ++i) {
+        uint8_t c = at(packed, first + i);
+        parent[i] = (c == kRoot) ? kIstNoParent
+                  : uint32_t(PermutationUtils::rankAfterSwap(perm.data(), n, first + i, c));
+        std::next_permutation(perm.begin(), perm.end());
+    }
+}
+
+uint64_t IstHeader::fileSize() const {
+    if (flags & kIstSwapCodes)
+        return parentOffset() + codesBytes();
+    if (flags & kIstHasChildIndex)
+        return childrenOffset() + 4 * (count - 1);
+    return offsetsOffset();
+}
+
+std::string IstWriter::path(int n, int tree) {
+    std::string dir = "ist/" + std::to_string(n);
+    std::filesystem::create_directories(dir);
+    return dir + "/Tree_" + std::to_string(n) + "_" + std::to_string(tree) + ".ist";
+}
+
+bool IstWriter::write(const std::string& path, int n, int tree, uint64_t root,
+                      const uint32_t* parent, uint64_t count, const ChildIndex* kids) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "Failed to open file: " << path << std::endl;
+        return false;
+    }
+    IstHeader h = IstHeader::make(n, tree, count, root, kids ? kIstHasChildIndex : 0);
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(reinterpret_cast<const char*>(parent), std::streamsize(4 * count));
+    if (kids) {
+        out.write(reinterpret_cast<const char*>(kids->offsets.data()), std::streamsize(4 * (count + 1)));
+        out.write(reinterpret_cast<const char*>(kids->children.data()), std::streamsize(4 * (count - 1)));
+    }
+    if (!out.good()) {
+        std::cerr << "Error writing tree to " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool IstWriter::writeSwapCodes(const std::string& path, int n, int tree, uint64_t root,
+                               const uint32_t* parent, uint64_t count) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "Failed to open file: " << path << std::endl;
+        return false;
+    }
+    IstHeader h = IstHeader::make(n, tree, count, root, kIstSwapCodes);
+    std::vector<uint8_t> code(count), packed(h.codesBytes());
+    SwapCode::encodeRange(parent, 0, count, n, code.data());
+    SwapCode::pack(code.data(), count, packed.data());
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(reinterpret_cast<const char*>(packed.data()), std::streamsize(packed.size()));
+    if (!out.good()) {
+        std::cerr << "Error writing tree to " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool IstReader::open(const std::string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error opening file: " << path << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(IstHeader)) {
+        std::cerr << "Not an .ist file: " << path << std::endl;
+        ::close(fd);
+        return false;
+    }
+    void* map = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "Could not map " << path << std::endl;
+        return false;
+    }
+    map_ = map;
+    mapSize_ = size_t(st.st_size);
+
+    const uint8_t* base = static_cast<const uint8_t*>(map);
+    hdr_ = reinterpret_cast<const IstHeader*>(base);
+    if (!hdr_->valid() || hdr_->fileSize() > mapSize_) {
+        std::cerr << "Corrupt or truncated .ist file: " << path << std::endl;
+        close();
+        return false;
+    }
+    if (hdr_->flags & kIstSwapCodes)
+        codes_ = base + hdr_->parentOffset();
+    else
+        parent_ = reinterpret_cast<const uint32_t*>(base + hdr_->parentOffset());
+    if (hdr_->flags & kIstHasChildIndex) {
+        offsets_ = reinterpret_cast<const uint32_t*>(base + hdr_->offsetsOffset());
+        children_ = reinterpret_cast<const uint32_t*>(base + hdr_->childrenOffset());
+    }
+    return true;
+}
+
+void IstReader::close() {
+    if (map_) munmap(map_, mapSize_);
+    map_ = nullptr;
+    mapSize_ = 0;
+    hdr_ = nullptr;
+    parent_ = offsets_ = children_ = nullptr;
+    codes_ = nullptr;
+}
+
+uint32_t IstReader::parent(uint64_t v) const {
+    if (parent_) return parent_[v];
+    uint32_t p;
+    SwapCode::decodeRange(codes_, v, 1, n(), &p);
+    return p;
+}
+
+void IstReader::parents(uint64_t first, uint64_t count, uint32_t* out) const {
+    if (parent_) std::copy(parent_ + first, parent_ + first + count, out);
+    else SwapCode::decodeRange(codes_, first, count, n(), out);
+}
@@ -0,0 +1,110 @@
+#ifndef IST_FORMAT_HPP
+#define IST_FORMAT_HPP
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include "child_index.hpp"
+
+// Binary independent-spanning-tree file (.ist), native little-endian:
+//   IstHeader                          64 bytes
+//   uint32_t parent[count]             root holds kIstNoParent
+//   uint32_t offsets[count+1]          only with kIstHasChildIndex
+//   uint32_t children[count-1]         only with kIstHasChildIndex
+// With kIstSwapCodes the parent array is replaced by 4-bit swap codes,
+// two vertices per byte (even vertex in the low nibble), and there is no
+// child index. Vertex v is the v-th permutation of {1..n} in lexicographic
+// order.
+constexpr uint32_t kIstVersion = 1;
+constexpr uint32_t kIstNoParent = UINT32_MAX;
+constexpr uint32_t kIstHasChildIndex = 1u << 0;
+constexpr uint32_t kIstSwapCodes = 1u << 1;
+
+struct IstHeader {
+    char magic[4];          // "IST1"
+    uint32_t version;
+    uint32_t n;
+    uint32_t tree;          // 1..n-1
+    uint64_t count;         // n!
+    uint64_t root;          // vertex index of the root
+    uint32_t flags;
+    uint8_t reserved[28];
+
+    static IstHeader make(int n, int tree, uint64_t count, uint64_t root, uint32_t flags);
+    bool valid() const;
+    // Offsets of each section from the start of the file
+    uint64_t parentOffset() const { return sizeof(IstHeader); }
+    uint64_t offsetsOffset() const { return parentOffset() + 4 * count; }
+    uint64_t codesBytes() const { return (count + 1) / 2; }
+    uint64_t childrenOffset() const { return offsetsOffset() + 4 * (count + 1); }
+    uint64_t fileSize() const;
+};
+static_assert(sizeof(IstHeader) == 64, "IstHeader must stay 64 bytes");
+
+// Every tree edge is an adjacent transposition, so a parent is fully given
+// by the swap position 0..n-2 that reaches it; the root is coded kRoot.
+struct SwapCode {
+    static constexpr uint8_t kRoot = 0xF;
+
+    // Swapping positions p, p+1 leaves the factorial-base digits of the
+    // rank above p unchanged and always changes digit p, so p is the most
+    // significant digit in which v and its parent differ. No unranking.
+    static uint8_t encode(uint64_t v, uint32_t parent, int n);
+    // code[i] = encode(first+i, parent[i]), one byte per vertex
+    static void encodeRange(const uint32_t* parent, uint64_t first, uint64_t count, int n, uint8_t* code);
+    // Two codes per byte; count must be even (n! always is)
+    static void pack(const uint8_t* code, uint64_t count, uint8_t* packed);
+    // Parents of vertices [first, first+count) from packed codes indexed from 0
+    static void decodeRange(const uint8_t* packed, uint64_t first, uint64_t count, int n, uint32_t* parent);
+    static uint8_t at(const uint8_t* packed, uint64_t v) { return (packed[v >> 1] >> (4 * (v & 1))) & 0xF; }
+};
+
+class IstWriter {
+public:
+    // Write a whole tree; kids may be null to omit the child index
+    static bool write(const std::string& path, int n, int tree, uint64_t root,
+                      const uint32_t* parent, uint64_t count, const ChildIndex* kids);
+    // Write a whole tree as packed swap codes
+    static bool writeSwapCodes(const std::string& path, int n, int tree, uint64_t root,
+                               const uint32_t* parent, uint64_t count);
+    // "ist/<n>/Tree_<n>_<tree>.ist", creating the directory
+    static std::string path(int n, int tree);
+};
+
+// Zero-copy reader: maps the file and serves lookups straight from it
+class IstReader {
+public:
+    IstReader() = default;
+    ~IstReader() { close(); }
+    IstReader(const IstReader&) = delete;
+    IstReader& operator=(const IstReader&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    const IstHeader& header() const { return *hdr_; }
+    int n() const { return int(hdr_->n); }
+    int tree() const { return int(hdr_->tree); }
+    uint64_t count() const { return hdr_->count; }
+    uint64_t root() const { return hdr_->root; }
+
+    // O(1) from a parent array; from swap codes it unranks v, O(n^2)
+    uint32_t parent(uint64_t v) const;
+    // Parents of [first, first+count) in one pass (either encoding)
+    void parents(uint64_t first, uint64_t count, uint32_t* out) const;
+    bool hasSwapCodes() const { return codes_ != nullptr; }
+    bool hasChildIndex() const { return offsets_ != nullptr; }
+    const uint32_t* childrenBegin(uint64_t p) const { return children_ + offsets_[p]; }
+    const uint32_t* childrenEnd(uint64_t p) const { return children_ + offsets_[p+1]; }
+
+private:
+    void* map_ = nullptr;
+    size_t mapSize_ = 0;
+    const IstHeader* hdr_ = nullptr;
+    const uint32_t* parent_ = nullptr;
+    const uint8_t* codes_ = nullptr;
+    const uint32_t* offsets_ = nullptr;
+    const uint32_t* children_ = nullptr;
+};
+
+#endif // IST_FORMAT_HPP
@@ -0,0 +1,100 @@
+//mpic++ -O3 -std=c++17 -fopenmp ist_verifier.cpp verifier.cpp permutation_utils.cpp child_index.cpp ist_format.cpp arena.cpp -o ist_verifier
+// mpiexec -n 4 ./ist_verifier 10 [dir]
+#include "verifier.hpp"
+#include "ist_format.hpp"
+#include "permutation_utils.hpp"
+#include "arena.hpp"
+#include <mpi.h>
+#include <omp.h>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Checks the .ist trees of one n (any builder, parent arrays or swap
+// codes) against the independent spanning tree contract. Every rank loads
+// all trees and verifies its share of the vertices with OpenMP.
+int main(int argc, char* argv[]) {
+    MPI_Init(&argc, &argv);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    int n = argc >= 2 ? std::atoi(argv[1]) : 0;
+    if (argc < 2 || argc > 3 || n < 3 || n > 12) {
+        if (rank == 0) std::cerr << "Usage: " << argv[0] << " <n> [dir]\n"
+                                 << "  checks <dir>/Tree_<n>_<t>.ist for t = 1..n-1 (dir defaults to ist/<n>), 3 <= n <= 12\n";
+        MPI_Finalize(); return 1;
+    }
+    std::string dir = argc == 3 ? argv[2] : "ist/" + std::to_string(n);
+    const int T = n - 1;
+    const uint64_t count = PermutationUtils::factorial(n);
+
+    // Parents of every tree, decoded into huge pages: the walks are random
+    // reads, so fewer TLB misses matter more than the copy
+    double load_start = MPI_Wtime();
+    Arena arena;
+    std::vector<const uint32_t*> parents(T);
+    int ok = 1;
+    for (int t = 1; t <= T && ok; ++t) {
+        std::string fn = dir + "/Tree_" + std::to_string(n) + "_" + std::to_string(t) + ".ist";
+        IstReader reader;
+        if (!reader.open(fn)) { ok = 0; break; }
+        if (reader.n() != n || reader.tree() != t || reader.count() != count || reader.root() != 0) {
+            if (rank == 0) std::cerr << fn << ": header is not tree " << t << " of n=" << n << " rooted at the identity\n";
+            ok = 0; break;
+        }
+        uint32_t* out = arena.allocate<uint32_t>(count);
+        const uint64_t step = uint64_t(1) << 16;
+        #pragma omp parallel for schedule(static)
+        for (uint64_t lo = 0; lo < count; lo += step)
+            reader.parents(lo, std::min(step, count - lo), out + lo);
+        parents[t-1] = out;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (!ok) { MPI_Finalize(); return 1; }
+    double load_end = MPI_Wtime();
+
+    uint64_t first = count * rank / size, last = count * (rank + 1) / size;
+    TreeVerifier verifier(n, parents, kIstNoParent);
+    TreeVerifier::Report r = verifier.run(first, last);
+    double verify_end = MPI_Wtime();
+
+    // Counts summed, cyclic trees OR-ed; every rank learns the verdict
+    TreeVerifier::Report all;
+    uint64_t sums[4] = {r.vertices, r.badParents, r.sharedPaths, r.steps};
+    MPI_Allreduce(MPI_IN_PLACE, sums, 4, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    all.vertices = sums[0]; all.badParents = sums[1]; all.sharedPaths = sums[2]; all.steps = sums[3];
+    MPI_Allreduce(&r.cyclicTrees, &all.cyclicTrees, 1, MPI_UINT32_T, MPI_BOR, MPI_COMM_WORLD);
+    MPI_Reduce(&r.maxDepth, &all.maxDepth, 1, MPI_UINT64_T, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&r.firstFailure, &all.firstFailure, 1, MPI_UINT64_T, MPI_MIN, 0, MPI_COMM_WORLD);
+    double verifyTime = verify_end - load_end, slowest = 0;
+    MPI_Reduce(&verifyTime, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        std::cout << std::fixed << std::setprecision(3);
+        std::cout << "Verified " << T << " trees on n=" << n << ": " << all.vertices << " vertices ("
+                  << size << " ranks x " << omp_get_max_threads() << " threads)\n";
+        std::cout << "Bad parents: " << all.badParents << "\n";
+        std::cout << "Trees with cycles:";
+        for (int t = 1; t <= T; ++t)
+            if (all.cyclicTrees >> (t - 1) & 1) std::cout << " " << t;
+        std::cout << (all.cyclicTrees ? "\n" : " none\n");
+        std::cout << "Vertices whose paths meet: " << all.sharedPaths << "\n";
+        std::cout << "Longest root path: " << all.maxDepth << " edges, parent links followed: " << all.steps << "\n";
+        if (all.firstFailure != TreeVerifier::Report::kNone) {
+            static const char* kinds[] = {"", "bad parent", "cycle", "paths meet before the root"};
+            std::vector<uint8_t> perm(n);
+            PermutationUtils::unrank(all.firstFailure >> 8, n, perm.data());
+            std::cout << "First failure: vertex " << PermutationUtils::toKey(perm.data(), n)
+                      << " in tree " << ((all.firstFailure >> 4) & 0xF) << ": " << kinds[all.firstFailure & 0xF] << "\n";
+        }
+        std::cout << "Load time: " << (load_end - load_start) << " seconds\n";
+        std::cout << "Verification time: " << slowest << " seconds\n";
+        std::cout << (all.ok() ? "PASSED: independent spanning trees\n" : "FAILED\n");
+    }
+
+    MPI_Finalize();
+    return all.ok() ? 0 : 1;
+}
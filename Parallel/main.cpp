@@ -1,41 +1,74 @@
-//mpic++ -O3 -std=c++17 main.cpp tree_builder.cpp permutation_utils.cpp -o parallel_tree_builder
-// mpiexec -n 4 ./parallel_tree_builder 10
+//mpic++ -O3 -std=c++17 -fopenmp main.cpp tree_builder.cpp permutation_utils.cpp child_index.cpp ist_format.cpp async_writer.cpp checkpoint.cpp vertex_order.cpp arena.cpp -o parallel_tree_builder
+// mpiexec -n 4 ./parallel_tree_builder 10 [--shared] [--mpiio] [--ist] [--swap4] [--async] [--stream] [--resume] [--locality] [--hugetlb]
 #include "tree_builder.hpp"
+#include "permutation_utils.hpp"
 #include <mpi.h>
+#include <sys/resource.h>
+#include <vector>
+#include <string>
 #include <iostream>
 #include <iomanip>
+#include <memory>
 
 int main(int argc, char* argv[]) {
     MPI_Init(&argc,&argv);
     int rank,size; MPI_Comm_rank(MPI_COMM_WORLD,&rank);
     MPI_Comm_size(MPI_COMM_WORLD,&size);
 
-    if (argc!=2) {
-        if (rank==0) std::cerr<<"Usage: "<<argv[0]<<" <n>\n";
+    ParallelTreeBuilder::Options opts;
+    bool locality = false;
+    bool badArgs = (argc < 2);
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--shared") opts.sharedTables = true;
+        else if (arg == "--mpiio") opts.collectiveOutput = true;
+        else if (arg == "--ist") opts.binaryOutput = true;
+        else if (arg == "--swap4") opts.binaryOutput = opts.swapCodes = true;
+        else if (arg == "--async") opts.asyncOutput = true;
+        else if (arg == "--stream") opts.streaming = opts.binaryOutput = true;
+        else if (arg == "--resume") opts.streaming = opts.binaryOutput = opts.resume = true;
+        else if (arg == "--locality") locality = true;
+        else if (arg == "--hugetlb") opts.explicitHugePages = true;
+        else badArgs = true;
+    }
+    if (badArgs) {
+        if (rank==0) std::cerr<<"Usage: "<<argv[0]<<" <n> [--shared] [--mpiio] [--ist] [--swap4] [--async] [--stream] [--resume] [--locality] [--hugetlb]\n"
+                              <<"  --shared  build permutation tables once per node in MPI shared memory\n"
+                              <<"  --mpiio   every rank writes its part of the output files with MPI-IO\n"
+                              <<"  --ist     write binary .ist trees to ist/<n>/ instead of DOT\n"
+                              <<"  --swap4   .ist trees as 4-bit swap positions (implies --ist)\n"
+                              <<"  --async   rank 0 writes DOT files from a background writer thread\n"
+                              <<"  --stream  no tables, write .ist trees chunk by chunk (implies --ist, allows n <= 12)\n"
+                              <<"  --resume  --stream, skipping blocks a previous run completed\n"
+                              <<"  --locality  report parent/child index distances in lexicographic and SJT order\n"
+                              <<"  --hugetlb   tables in explicit huge pages (MAP_HUGETLB) when the pool has room\n";
         MPI_Finalize(); return 1;
     }
-    int n=std::stoi(argv[1]); if (n<2||n>10) {
-        if (rank==0) std::cerr<<"n must be 2..10\n";
+    int maxN = opts.streaming ? 12 : 10;
+    int n=std::stoi(argv[1]); if (n<2||n>maxN) {
+        if (rank==0) std::cerr<<"n must be 2.."<<maxN<<(opts.streaming ? "\n" : " (2..12 with --stream)\n");
         MPI_Finalize(); return 1;
     }
 
+    int written = 1;
+    {   // the builder owns MPI resources and must go away before MPI_Finalize
     double start_time = MPI_Wtime();
     
-    ParallelTreeBuilder builder(n);
-    double init_time = MPI_Wtime();
-    
-    int T=n-1, per=T/size, rem=T%size;
-    int lo=(rank<rem? rank*(per+1)+1 : rem*(per+1)+(rank-rem)*per+1);
-    int hi=(rank<rem? lo+per : lo+per-1);
-    std::vector<int> setTrees;
-    for (int t=lo; t<=hi; ++t) setTrees.push_back(t);
-
+    // Each rank takes an equal block of vertices and computes its parents
+    // in all n-1 trees, so any rank count splits the work evenly
+    size_t lo, hi;
+    ParallelTreeBuilder::vertexRange(PermutationUtils::factorial(n), rank, size, lo, hi);
     double tree_dist_time = MPI_Wtime();
     
-    builder.generateEdges(setTrees);
+    auto builder = std::make_unique<ParallelTreeBuilder>(n, lo, hi, opts);
+    double init_time = MPI_Wtime();
+    
+    // streaming computes and writes in one pass
+    if (opts.streaming) builder->streamTrees(rank, size);
+    else builder->generateEdges();
     double edge_gen_time = MPI_Wtime();
     
-    builder.assembleAndWrite(rank,size);
+    if (!opts.streaming) written = builder->assembleAndWrite(rank,size);
     double write_time = MPI_Wtime();
     
     MPI_Barrier(MPI_COMM_WORLD);
@@ -45,12 +78,38 @@ int main(int argc, char* argv[]) {
     if (rank == 0) {
         std::cout << "\nTiming Information:\n";
         std::cout << std::fixed << std::setprecision(3);
-        std::cout << "Initialization time: " << (init_time - start_time) << " seconds\n";
-        std::cout << "Tree distribution time: " << (tree_dist_time - init_time) << " seconds\n";
-        std::cout << "Edge generation time: " << (edge_gen_time - tree_dist_time) << " seconds\n";
+        std::cout << "Work distribution time: " << (tree_dist_time - start_time) << " seconds\n";
+        std::cout << "Initialization time: " << (init_time - tree_dist_time) << " seconds\n";
+        std::cout << "Edge generation time: " << (edge_gen_time - init_time) << " seconds\n";
         std::cout << "Assembly and write time: " << (write_time - edge_gen_time) << " seconds\n";
         std::cout << "Total execution time: " << (end_time - start_time) << " seconds\n";
+        // measurement only, outside the timed run
+        if (locality) builder->localityReport();
+    }
+
+    // Freeing the tables; the slowest rank counts
+    double teardown_start = MPI_Wtime();
+    builder.reset();
+    double teardown = MPI_Wtime() - teardown_start, slowest = 0;
+    MPI_Reduce(&teardown, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+        std::cout << "Teardown time: " << slowest << " seconds\n";
+
+    // Peak resident memory (ru_maxrss is in KiB on Linux) and page
+    // faults of every rank
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long mine[2] = {usage.ru_maxrss, usage.ru_minflt + usage.ru_majflt};
+    std::vector<long> all(rank == 0 ? 2 * size : 0);
+    MPI_Gather(mine, 2, MPI_LONG, all.data(), 2, MPI_LONG, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        std::cout << "\nPeak memory and page faults per rank:\n";
+        for (int r = 0; r < size; ++r)
+            std::cout << "Rank " << r << ": " << (all[2*r] / 1024.0) << " MB, " << all[2*r+1] << " page faults\n";
+    }
     }
 
-    MPI_Finalize(); return 0;
+    // A failed write on rank 0 fails the whole run
+    MPI_Allreduce(MPI_IN_PLACE, &written, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    MPI_Finalize(); return written ? 0 : 1;
 }
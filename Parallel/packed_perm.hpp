@@ -0,0 +1,107 @@
+#ifndef PACKED_PERM_HPP
+#define PACKED_PERM_HPP
+
+#include <cstdint>
+#include "permutation_utils.hpp"
+
+// A permutation of {1..n}, n <= 16, packed into one 64-bit word at 4 bits
+// per position. Position i lives in bits [4i, 4i+4) and holds the symbol
+// minus one, so that n = 16 still fits. All kernels are register-only.
+struct PackedPerm {
+    uint64_t bits = 0;
+
+    PackedPerm() = default;
+    explicit PackedPerm(uint64_t b) : bits(b) {}
+
+    static PackedPerm pack(const uint8_t* perm, int n) {
+        uint64_t b = 0;
+        for (int i = 0; i < n; ++i)
+            b |= uint64_t(perm[i] - 1) << (4 * i);
+        return PackedPerm(b);
+    }
+
+    // 0x...3210 truncated to n nibbles
+    static PackedPerm identity(int n) {
+        return PackedPerm(0xFEDCBA9876543210ull & lowNibbles(n));
+    }
+
+    static uint64_t lowNibbles(int n) {
+        return n >= 16 ? ~0ull : (1ull << (4 * n)) - 1;
+    }
+
+    void unpack(uint8_t* out, int n) const {
+        for (int i = 0; i < n; ++i)
+            out[i] = uint8_t(at(i) + 1);
+    }
+
+    // Raw 0-based nibble at position i
+    int at(int i) const { return int((bits >> (4 * i)) & 0xF); }
+    // Symbol (1..n) at position i
+    int symbol(int i) const { return at(i) + 1; }
+
+    // Exchange the symbols at positions pos and pos+1
+    PackedPerm swapAt(int pos) const {
+        uint64_t x = ((bits >> (4 * pos)) ^ (bits >> (4 * pos + 4))) & 0xF;
+        return PackedPerm(bits ^ (x << (4 * pos)) ^ (x << (4 * pos + 4)));
+    }
+
+    // Inverse permutation: inverse(n).at(s-1) is the position of symbol s
+    PackedPerm inverse(int n) const {
+        uint64_t inv = 0;
+        for (int i = 0; i < n; ++i)
+            inv |= uint64_t(i) << (4 * at(i));
+        return PackedPerm(inv);
+    }
+
+    // Last position (scanning from the end) whose symbol is out of place,
+    // or -1 for the identity
+    int firstMismatch(int n) const {
+        uint64_t diff = (bits ^ identity(n).bits) & lowNibbles(n);
+        return diff ? (63 - __builtin_clzll(diff)) >> 2 : -1;
+    }
+
+    // Lexicographic index (Lehmer code), same as PermutationUtils::rank
+    uint64_t rank(int n) const {
+        uint32_t placed = 0;
+        uint64_t r = 0;
+        for (int i = 0; i < n; ++i) {
+            int s = at(i);
+            int digit = s - __builtin_popcount(placed & ((1u << s) - 1));
+            r = r * (n - i) + digit;
+            placed |= 1u << s;
+        }
+        return r;
+    }
+
+    // Rank of swapAt(pos) given this permutation's rank; O(n) arithmetic
+    uint64_t rankAfterSwap(int n, uint64_t rank, int pos) const {
+        if (pos + 1 >= n) return rank;
+        int a = at(pos), b = at(pos+1);
+        int lo = a < b ? a : b, hi = a < b ? b : a;
+        int between = 0;
+        for (int j = pos + 2; j < n; ++j)
+            between += (at(j) > lo && at(j) < hi);
+        return rank + PermutationUtils::swapRankDelta(a, b, between, pos, n);
+    }
+
+    // rankAfterSwap for every position 0..n-2 at once. Walking from the
+    // right, the symbols past pos+1 are kept as a bitmask so each count
+    // of "symbols between a and b" is a single popcount.
+    void swapRanks(int n, uint64_t rank, uint64_t* out) const {
+        uint32_t after = 0;
+        for (int pos = n - 2; pos >= 0; --pos) {
+            int a = at(pos), b = at(pos+1);
+            int lo = a < b ? a : b, hi = a < b ? b : a;
+            uint32_t range = ((1u << hi) - 1) & ~((2u << lo) - 1);
+            int between = __builtin_popcount(after & range);
+            out[pos] = rank + PermutationUtils::swapRankDelta(a, b, between, pos, n);
+            after |= 1u << b;
+        }
+        out[n-1] = rank;
+    }
+
+    bool operator==(const PackedPerm& o) const { return bits == o.bits; }
+    bool operator!=(const PackedPerm& o) const { return bits != o.bits; }
+};
+
+#endif // PACKED_PERM_HPP
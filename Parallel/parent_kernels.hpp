@@ -0,0 +1,125 @@
+#ifndef PARENT_KERNELS_HPP
+#define PARENT_KERNELS_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include "packed_perm.hpp"
+#include "table_kernels.hpp"
+
+// Parent rules evaluated for a batch of up to kBatch vertices at once.
+// Inputs are the packed permutation, packed inverse and first mismatch of
+// each vertex, vertex i having rank first + i. The batch is unpacked into
+// structure-of-arrays form (one row of kBatch lanes per position), then:
+//
+//  - once per batch: the rank after every adjacent swap, the swap that
+//    would reach the root (if any) and the tree-independent positions;
+//  - per tree: every rule for every lane, the answer picked with selects,
+//    and the parent read from the swap ranks.
+//
+// All inner loops run over lanes with compile-time bounds and no branches,
+// so they vectorise; AVX2 is chosen at run time as for TableKernels.
+// Ranks fit 32 bits for n <= 12.
+struct ParentKernels {
+    static constexpr size_t kBatch = 32;
+
+    // Trees t0..t1. With Ranks, out[(t-1)*stride + i] = parent rank of
+    // vertex i; otherwise pos[(t-1)*stride + i] = its parent's swap
+    // position. The root (rank 0) is left to the caller.
+    template <int N, bool Ranks>
+    static void run(int t0, int t1, const PackedPerm* perm, const PackedPerm* loc, const uint8_t* mis,
+                    uint32_t first, size_t count, size_t stride, uint8_t* pos, uint32_t* out) {
+#if TABLE_KERNELS_X86
+        if (TableKernels::hasAvx2()) {
+            runAvx2<N, Ranks>(t0, t1, perm, loc, mis, first, count, stride, pos, out);
+            return;
+        }
+#endif
+        batch<N, Ranks>(t0, t1, perm, loc, mis, first, count, stride, pos, out);
+    }
+
+#if TABLE_KERNELS_X86
+    template <int N, bool Ranks>
+    __attribute__((target("avx2")))
+    static void runAvx2(int t0, int t1, const PackedPerm* perm, const PackedPerm* loc, const uint8_t* mis,
+                        uint32_t first, size_t count, size_t stride, uint8_t* pos, uint32_t* out) {
+        batch<N, Ranks>(t0, t1, perm, loc, mis, first, count, stride, pos, out);
+    }
+#endif
+
+    template <int N, bool Ranks>
+    __attribute__((always_inline))
+    static inline void batch(int t0, int t1, const PackedPerm* perm, const PackedPerm* loc, const uint8_t* mis,
+                             uint32_t first, size_t count, size_t stride, uint8_t* pos, uint32_t* out) {
+        constexpr uint32_t kNone = 0xFF;
+        constexpr uint64_t ident = 0xFEDCBA9876543210ull & ((1ull << (4 * N)) - 1);
+        // symbol at position j / position of symbol j, 0-based
+        uint32_t at[N][kBatch], where[N][kBatch];
+        uint32_t posPrev[kBatch], posMis[kBatch], rootAt[kBatch];
+        uint32_t swapRank[N * kBatch];          // [p*kBatch + i]: rank after swapping p, p+1
+
+        for (int j = 0; j < N; ++j) {
+            #pragma omp simd
+            for (size_t i = 0; i < count; ++i) {
+                at[j][i] = uint32_t(perm[i].bits >> (4 * j)) & 0xF;
+                where[j][i] = uint32_t(loc[i].bits >> (4 * j)) & 0xF;
+            }
+        }
+        #pragma omp simd
+        for (size_t i = 0; i < count; ++i) {
+            const uint64_t P = perm[i].bits, L = loc[i].bits;
+            const uint32_t k = mis[i];
+            posPrev[i] = uint32_t(L >> (4 * at[N-2][i])) & 0xF;
+            posMis[i] = uint32_t(L >> (4 * k)) & 0xF;
+            // one adjacent swap from the identity: it must be at k-1, k
+            uint64_t x = ((P >> (4 * k - 4)) ^ (P >> (4 * k))) & 0xF;
+            rootAt[i] = (P ^ (x << (4 * k - 4)) ^ (x << (4 * k))) == ident ? k - 1 : kNone;
+        }
+
+        if (Ranks) {
+            // PackedPerm::rankAfterSwap for every position, lane-parallel
+            for (int p = 0; p + 1 < N; ++p) {
+                const uint32_t up = uint32_t(PermutationUtils::kFactorial[N-1-p]);
+                const uint32_t down = uint32_t(PermutationUtils::kFactorial[N-2-p]);
+                uint32_t between[kBatch] = {};
+                for (int j = p + 2; j < N; ++j) {
+                    #pragma omp simd
+                    for (size_t i = 0; i < count; ++i) {
+                        uint32_t a = at[p][i], b = at[p+1][i], s = at[j][i];
+                        between[i] += (s > a) != (s > b) ? 1u : 0u;
+                    }
+                }
+                #pragma omp simd
+                for (size_t i = 0; i < count; ++i) {
+                    uint32_t d = (between[i] + 1) * up - between[i] * down;
+                    uint32_t r = first + uint32_t(i);
+                    swapRank[p * kBatch + i] = at[p][i] < at[p+1][i] ? r + d : r - d;
+                }
+            }
+            #pragma omp simd
+            for (size_t i = 0; i < count; ++i)
+                swapRank[(N-1) * kBatch + i] = first + uint32_t(i);
+        }
+
+        for (int t = t0; t <= t1; ++t) {
+            const uint32_t* posT = where[t-1];
+            const uint32_t* posT2 = where[t >= 2 ? t-2 : 0];
+            #pragma omp simd
+            for (size_t i = 0; i < count; ++i) {
+                const uint32_t last = at[N-1][i], prev = at[N-2][i], posN = where[N-1][i];
+                // last == n: tree n-1 swaps with prev, the others fall back
+                uint32_t fallback = (prev == uint32_t(t-1) || prev == N-2) ? posMis[i] : posT[i];
+                fallback = (t == 2 && posT[i] == rootAt[i]) ? posT2[i] : fallback;
+                const uint32_t ruleN = (t == N-1) ? posPrev[i] : fallback;
+                // n-1 then n: move n forward unless that reaches the root
+                const bool pairN = last == N-2 && prev == N-1 && posN != rootAt[i];
+                const uint32_t rulePair = (t == 1) ? posN : posT2[i];
+                const uint32_t ruleLast = (last == uint32_t(t-1)) ? posN : posT[i];
+                const uint32_t p = last == N-1 ? ruleN : (pairN ? rulePair : ruleLast);
+                if (Ranks) out[(t-1) * stride + i] = swapRank[p * kBatch + i];
+                else pos[(t-1) * stride + i] = uint8_t(p);
+            }
+        }
+    }
+};
+
+#endif // PARENT_KERNELS_HPP
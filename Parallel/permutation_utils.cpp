@@ -1,50 +1,130 @@
 #include "permutation_utils.hpp"
 #include <algorithm>
 #include <numeric>
-#include <iostream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-std::vector<std::vector<uint8_t>> PermutationUtils::allPerms(int n) {
-    std::cout << "Generating permutations for n=" << n << std::endl;
-    
-    // Pre-calculate factorial size to avoid resizing
-    int factorial = 1;
-    for(int i = 2; i <= n; i++) {
-        factorial *= i;
-    }
-    
-    std::vector<uint8_t> base(n);
-    std::iota(base.begin(), base.end(), 1);
-    
-    // Pre-allocate the exact space needed
-    std::vector<std::vector<uint8_t>> result;
-    result.reserve(factorial);
-    
-    std::cout << "Initial base: ";
-    for (uint8_t x : base) std::cout << (int)x << " ";
-    std::cout << std::endl;
-    
-    // More efficient insertion
-    result.push_back(base);  // Add the first permutation
+AlignedBuffer allocateAligned(size_t bytes) {
+    // Round up so the allocation itself is a whole number of cache lines
+    bytes = (bytes + kCacheLine - 1) / kCacheLine * kCacheLine;
+    return AlignedBuffer(bytes ? new (std::align_val_t(kCacheLine)) uint8_t[bytes] : nullptr);
+}
+
+size_t PermTable::strideFor(int width) {
+    size_t stride = 1;
+    while (stride < size_t(width)) stride <<= 1;
+    return stride;
+}
+
+void PermTable::resize(size_t rows, int width) {
+    storage_ = allocateAligned(bytesFor(rows, width));
+    data_ = storage_.get();
+    rows_ = rows;
+    stride_ = strideFor(width);
+    width_ = width;
+}
+
+void PermTable::attach(uint8_t* data, size_t rows, int width) {
+    storage_.reset();
+    data_ = data;
+    rows_ = rows;
+    stride_ = strideFor(width);
+    width_ = width;
+}
+
+void PermutationUtils::allPerms(int n, PermTable& out) {
+    permRange(n, 0, factorial(n), out);
+}
+
+void PermutationUtils::permRange(int n, uint64_t first, uint64_t count, PermTable& out) {
+    // Size the table once; every row is written in place below
+    out.resize(count, n);
+    fillRange(n, first, out);
+}
+
+void PermutationUtils::fillRange(int n, uint64_t first, PermTable& out) {
+#ifdef _OPENMP
+    // Rows are split the same way as schedule(static), so each thread
+    // first-touches the rows its later loops over the table will read
+    #pragma omp parallel
+    fillShare(n, first, out, omp_get_thread_num(), omp_get_num_threads());
+#else
+    fillShare(n, first, out, 0, 1);
+#endif
+}
+
+void PermutationUtils::fillShare(int n, uint64_t first, PermTable& out, int part, int parts) {
+    uint64_t lo = out.rows() * part / parts, hi = out.rows() * (part + 1) / parts;
+    if (lo == hi) return;
     
-    std::cout << "Starting permutation generation...\n";
-    while (std::next_permutation(base.begin(), base.end())) {
-        result.push_back(base);
-        if (result.size() <= 3) {
-            std::cout << "Added permutation: ";
-            for (uint8_t x : base) std::cout << (int)x << " ";
-            std::cout << std::endl;
-        }
+    // Jump to the first row by unranking, then step lexicographically
+    uint8_t base[32];
+    unrank(first + lo, n, base);
+    for (uint64_t i = lo; i < hi; ++i) {
+        std::copy(base, base + n, out.row(i));
+        std::next_permutation(base, base + n);
     }
-    
-    std::cout << "Generated " << result.size() << " permutations\n";
-    return result;
 }
 
-std::string PermutationUtils::toKey(const std::vector<uint8_t>& perm) {
+std::string PermutationUtils::toKey(const uint8_t* perm, int n) {
     // Faster string construction with single allocation
     std::string s;
-    s.reserve(perm.size());
-    for (uint8_t v : perm)
-        s.push_back(char('0' + v));
+    s.reserve(n);
+    for (int i = 0; i < n; ++i)
+        s.push_back(symbolChar(perm[i]));
     return s;
 }
+
+uint64_t PermutationUtils::factorial(int n) {
+    return kFactorial[n];
+}
+
+uint64_t PermutationUtils::rank(const uint8_t* perm, int n) {
+    // Horner form of sum(d_i * (n-1-i)!), where d_i counts the symbols
+    // smaller than perm[i] that have not been placed yet
+    uint32_t placed = 0;
+    uint64_t r = 0;
+    for (int i = 0; i < n; ++i) {
+        uint32_t below = (1u << perm[i]) - 2;   // bits 1..perm[i]-1
+        int digit = perm[i] - 1 - __builtin_popcount(placed & below);
+        r = r * (n - i) + digit;
+        placed |= 1u << perm[i];
+    }
+    return r;
+}
+
+void PermutationUtils::unrank(uint64_t idx, int n, uint8_t* out) {
+    // Peel off the factorial-base digits from the least significant end
+    int digits[32];
+    for (int i = n - 1; i >= 0; --i) {
+        digits[i] = int(idx % (n - i));
+        idx /= (n - i);
+    }
+    // Each digit selects among the symbols still unused, smallest first
+    uint32_t unused = ((1u << n) - 1) << 1;     // bits 1..n
+    for (int i = 0; i < n; ++i) {
+        uint32_t m = unused;
+        for (int k = 0; k < digits[i]; ++k)
+            m &= m - 1;
+        int sym = __builtin_ctz(m);
+        out[i] = uint8_t(sym);
+        unused &= ~(1u << sym);
+    }
+}
+
+uint64_t PermutationUtils::sjtRank(const uint8_t* perm, int n) {
+    // pos[k] = place of k among the symbols <= k; symbol k then adds the
+    // digit of its sweep, which runs backwards after an even rank
+    int pos[32];
+    uint32_t seen = 0;
+    for (int i = 0; i < n; ++i) {
+        int k = perm[i];
+        pos[k] = __builtin_popcount(seen & ((1u << k) - 2));
+        seen |= 1u << k;
+    }
+    uint64_t r = 0;
+    for (int k = 2; k <= n; ++k)
+        r = r * k + uint64_t(r & 1 ? pos[k] : k - 1 - pos[k]);
+    return r;
+}
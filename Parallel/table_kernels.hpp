@@ -0,0 +1,133 @@
+#ifndef TABLE_KERNELS_HPP
+#define TABLE_KERNELS_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include "packed_perm.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define TABLE_KERNELS_X86 1
+#else
+#define TABLE_KERNELS_X86 0
+#endif
+
+// Batch kernels for the per-vertex tables: from a flat store of permutation
+// rows, fill the packed permutation, its packed inverse and the first
+// mismatch position (1 for the identity) of every row.
+//
+// With rows 16 bytes apart (PermTable stride for 9 <= n <= 16) each row is
+// one vector and the mismatch is one compare against the identity and a bit
+// scan. The SSE2 variant (always there on x86-64) finds each symbol with
+// compare + movemask + ctz; the AVX2 variant, chosen at run time so the
+// plain -O3 build line still gets it, scatters with variable shifts.
+// Other strides and targets use the scalar PackedPerm kernels.
+struct TableKernels {
+    template <int N>
+    static void initRows(const uint8_t* rows, size_t stride, size_t count,
+                         PackedPerm* packed, PackedPerm* inverse, uint8_t* mismatch) {
+#if TABLE_KERNELS_X86
+        if (stride == 16) {
+            if (hasAvx2()) initRowsAvx2<N>(rows, count, packed, inverse, mismatch);
+            else initRowsSse2<N>(rows, count, packed, inverse, mismatch);
+            return;
+        }
+#endif
+        initRowsScalar<N>(rows, stride, count, packed, inverse, mismatch);
+    }
+
+    template <int N>
+    static void initRowsScalar(const uint8_t* rows, size_t stride, size_t count,
+                               PackedPerm* packed, PackedPerm* inverse, uint8_t* mismatch) {
+        for (size_t i = 0; i < count; ++i) {
+            PackedPerm perm = PackedPerm::pack(rows + i * stride, N);
+            packed[i] = perm;
+            inverse[i] = perm.inverse(N);
+            int k = perm.firstMismatch(N);
+            mismatch[i] = uint8_t(k < 0 ? 1 : k);
+        }
+    }
+
+#if TABLE_KERNELS_X86
+    static bool hasAvx2() {
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        return avx2;
+    }
+
+    // Bytes past N in a row are not initialised, so every movemask is cut to
+    // the live lanes and every packed word to lowNibbles(N).
+
+    // 16 symbols (1-based bytes) -> 64-bit nibble word: byte pairs b0 | b1<<4
+    static uint64_t packRow(__m128i x) {
+        x = _mm_sub_epi8(x, _mm_set1_epi8(1));
+        __m128i lo = _mm_and_si128(x, _mm_set1_epi16(0x00FF));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), _mm_set1_epi16(0x00F0));
+        __m128i pairs = _mm_packus_epi16(_mm_or_si128(lo, hi), _mm_setzero_si128());
+        return uint64_t(_mm_cvtsi128_si64(pairs));
+    }
+
+    template <int N>
+    static void initRowsSse2(const uint8_t* rows, size_t count,
+                             PackedPerm* packed, PackedPerm* inverse, uint8_t* mismatch) {
+        constexpr uint32_t live = (1u << N) - 1;
+        const __m128i ident = _mm_setr_epi8(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16);
+        for (size_t i = 0; i < count; ++i) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows + 16 * i));
+            packed[i] = PackedPerm(packRow(x) & PackedPerm::lowNibbles(N));
+
+            uint64_t inv = 0;
+            for (int s = 0; s < N; ++s) {
+                uint32_t at = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8(char(s + 1))))) & live;
+                inv |= uint64_t(__builtin_ctz(at)) << (4 * s);
+            }
+            inverse[i] = PackedPerm(inv);
+
+            uint32_t diff = ~uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(x, ident))) & live;
+            mismatch[i] = uint8_t(diff ? 31 - __builtin_clz(diff) : 1);
+        }
+    }
+
+    // AVX2: position i contributes i << 4*(p[i]-1) to the inverse; four
+    // positions per vpsllvq, then an OR across the lanes. No per-symbol
+    // search, so the cost no longer grows with N compares.
+    template <int N>
+    __attribute__((target("avx2")))
+    static void initRowsAvx2(const uint8_t* rows, size_t count,
+                             PackedPerm* packed, PackedPerm* inverse, uint8_t* mismatch) {
+        constexpr int groups = (N + 3) / 4;
+        constexpr uint32_t live = (1u << N) - 1;
+        const uint64_t nibbles = PackedPerm::lowNibbles(N);
+        const __m128i ident = _mm_setr_epi8(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16);
+        __m256i pos[groups];
+        for (int g = 0; g < groups; ++g)    // positions past N contribute 0
+            pos[g] = _mm256_setr_epi64x(lane(4*g, N), lane(4*g+1, N), lane(4*g+2, N), lane(4*g+3, N));
+        const __m256i one = _mm256_set1_epi64x(1);
+
+        for (size_t i = 0; i < count; ++i) {
+            const uint8_t* row = rows + 16 * i;
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row));
+            packed[i] = PackedPerm(packRow(x) & nibbles);
+
+            __m256i acc = _mm256_setzero_si256();
+            for (int g = 0; g < groups; ++g) {
+                int quad;
+                std::memcpy(&quad, row + 4 * g, 4);
+                __m256i sym = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(quad));
+                __m256i shift = _mm256_slli_epi64(_mm256_sub_epi64(sym, one), 2);
+                acc = _mm256_or_si256(acc, _mm256_sllv_epi64(pos[g], shift));
+            }
+            __m128i h = _mm_or_si128(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+            h = _mm_or_si128(h, _mm_unpackhi_epi64(h, h));
+            inverse[i] = PackedPerm(uint64_t(_mm_cvtsi128_si64(h)));
+
+            uint32_t diff = ~uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(x, ident))) & live;
+            mismatch[i] = uint8_t(diff ? 31 - __builtin_clz(diff) : 1);
+        }
+    }
+
+    static constexpr long long lane(int i, int n) { return i < n ? i : 0; }
+#endif
+};
+
+#endif // TABLE_KERNELS_HPP
@@ -1,5 +1,11 @@
 #include "tree_builder.hpp"
 #include "permutation_utils.hpp"
+#include "ist_format.hpp"
+#include "async_writer.hpp"
+#include "checkpoint.hpp"
+#include "table_kernels.hpp"
+#include "parent_kernels.hpp"
+#include "vertex_order.hpp"
 #include <mpi.h>
 #include <omp.h>
 #include <numeric>
@@ -7,33 +13,81 @@
 #include <iostream>
 #include <iomanip>
 #include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 
-ParallelTreeBuilder::ParallelTreeBuilder(int dimension)
+ParallelTreeBuilder::ParallelTreeBuilder(int dimension, size_t first, size_t last, const Options& opts)
     : dim_(dimension)
+    , count_(PermutationUtils::factorial(dimension))
     , treeCount_(dimension - 1)
-    , identity_(dimension)
+    , opts_(opts)
+    , first_(first)
+    , last_(last)
+    , tableFirst_(first)
+    , tableLast_(last)
+    , identity_(PackedPerm::identity(dimension))
+    , arena_(opts.explicitHugePages)
+    , parent_(ArenaAllocator<uint32_t>(&arena_))
+    , kernels_(&kernels(dimension))
+    , keys_(ArenaAllocator<char>(&arena_))
 {
     double start_time = MPI_Wtime();
     
     std::cout << "ParallelTreeBuilder constructor: n=" << dimension << std::endl;
-    std::iota(identity_.begin(), identity_.end(), 1);
     std::cout << "Identity permutation: ";
-    for (uint8_t x : identity_) std::cout << (int)x << " ";
+    for (int i = 0; i < dimension; ++i) std::cout << identity_.symbol(i) << " ";
     std::cout << std::endl;
 
-    // Generate permutations
+    // Streaming keeps no per-vertex tables; streamTrees picks the blocks
+    if (opts.streaming) {
+        std::cout << "Streaming " << count_ << " permutations" << std::endl;
+        return;
+    }
+    
+    // With shared tables one rank per node builds the union of the node's blocks
+    bool builds = true;
+    if (opts.sharedTables) {
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &nodeComm_);
+        int nodeRank;
+        MPI_Comm_rank(nodeComm_, &nodeRank);
+        uint64_t lo = first, hi = last;
+        MPI_Allreduce(MPI_IN_PLACE, &lo, 1, MPI_UINT64_T, MPI_MIN, nodeComm_);
+        MPI_Allreduce(MPI_IN_PLACE, &hi, 1, MPI_UINT64_T, MPI_MAX, nodeComm_);
+        tableFirst_ = lo;
+        tableLast_ = hi;
+        builds = (nodeRank == 0);
+    }
+    
+    // One block: permutation rows, packed perms, packed inverses, mismatches;
+    // every sub-table starts on a cache line
+    auto lines = [](size_t b) { return (b + kCacheLine - 1) / kCacheLine * kCacheLine; };
+    size_t span = tableLast_ - tableFirst_;
+    size_t permBytes = lines(PermTable::bytesFor(span, dimension));
+    size_t packedBytes = lines(span * sizeof(PackedPerm));
+    size_t bytes = permBytes + 2 * packedBytes + lines(span);
+    uint8_t* block = allocateTables(bytes, opts.sharedTables);
+    elements_.attach(block, span, dimension);
+    packed_ = reinterpret_cast<PackedPerm*>(block + permBytes);
+    locator_ = reinterpret_cast<PackedPerm*>(block + permBytes + packedBytes);
+    mismatchPos_ = block + permBytes + 2 * packedBytes;
+
+    // Generate the covered block of permutations
     double perm_start = MPI_Wtime();
-    elements_ = PermutationUtils::allPerms(dimension);
-    count_ = elements_.size();
-    std::cout << "Total permutations: " << count_ << std::endl;
+    if (builds)
+        PermutationUtils::fillRange(dimension, tableFirst_, elements_);
+    std::cout << "Owned permutations: [" << first << ", " << last << ") of " << count_ << std::endl;
     double perm_end = MPI_Wtime();
 
     // Initialize tables
     double init_start = MPI_Wtime();
-    locator_.resize(count_, std::vector<uint8_t>(dimension+1));
-    mismatchPos_.resize(count_);
-    globalKids_.resize(treeCount_, std::vector<std::vector<uint32_t>>(count_));
-    initData();
+    if (builds)
+        (this->*kernels_->initData)();
+    // everyone on the node waits for the builder before reading
+    if (opts.sharedTables)
+        MPI_Barrier(nodeComm_);
     double init_end = MPI_Wtime();
 
     double end_time = MPI_Wtime();
@@ -43,122 +97,379 @@ ParallelTreeBuilder::ParallelTreeBuilder(int dimension)
     if (rank == 0) {
         std::cout << "\nConstructor Timing:\n";
         std::cout << std::fixed << std::setprecision(3);
-        std::cout << "Permutation generation: " << (perm_end - perm_start) << " seconds\n";
+        std::cout << "Permutation generation (" << omp_get_max_threads() << " threads): "
+                  << (perm_end - perm_start) << " seconds\n";
         std::cout << "Data structure initialization: " << (init_end - init_start) << " seconds\n";
         std::cout << "Total constructor time: " << (end_time - start_time) << " seconds\n";
+        std::cout << "Table memory" << (opts.sharedTables ? " (shared per node): " : ": ")
+                  << (bytes / (1024.0 * 1024.0)) << " MB\n";
+        if (!opts.sharedTables)
+            std::cout << "Table pages: " << (arena_.hugetlbBytes() ? "hugetlb" : "transparent huge (madvise)") << "\n";
     }
 }
 
-void ParallelTreeBuilder::initData() {
-    // build index map
-    for (size_t i = 0; i < count_; ++i)
-        indexOf_[PermutationUtils::toKey(elements_[i])] = i;
-    
-    // Use OpenMP for parallel initialization
+ParallelTreeBuilder::~ParallelTreeBuilder() {
+    if (tableWin_ != MPI_WIN_NULL) MPI_Win_free(&tableWin_);
+    if (nodeComm_ != MPI_COMM_NULL) MPI_Comm_free(&nodeComm_);
+}
+
+uint8_t* ParallelTreeBuilder::allocateTables(size_t bytes, bool shared) {
+    if (!shared) return arena_.allocate<uint8_t>(bytes);
+    // Node rank 0 owns the whole segment; the rest attach with size 0. The
+    // window base is only promised 8-byte alignment, so the segment has a
+    // cache line of slack and rank 0 picks the offset of the first full
+    // line; the mapping is page-aligned on every rank, so one offset fits all.
+    int nodeRank;
+    MPI_Comm_rank(nodeComm_, &nodeRank);
+    MPI_Aint size = nodeRank == 0 ? MPI_Aint(bytes + kCacheLine) : 0;
+    void* base = nullptr;
+    MPI_Win_allocate_shared(size, 1, MPI_INFO_NULL, nodeComm_, &base, &tableWin_);
+    MPI_Aint segSize;
+    int dispUnit;
+    MPI_Win_shared_query(tableWin_, 0, &segSize, &dispUnit, &base);
+    uint64_t skew = (kCacheLine - reinterpret_cast<uintptr_t>(base) % kCacheLine) % kCacheLine;
+    MPI_Bcast(&skew, 1, MPI_UINT64_T, 0, nodeComm_);
+    uint8_t* tables = static_cast<uint8_t*>(base) + skew;
+    if (reinterpret_cast<uintptr_t>(tables) % kCacheLine != 0) {
+        std::cerr << "Shared table window is not mapped at the same cache-line offset on every rank" << std::endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return tables;
+}
+
+// One instantiation of every per-vertex kernel per n; the entry for dim_
+// is chosen once in the constructor
+template <int N>
+constexpr ParallelTreeBuilder::Kernels ParallelTreeBuilder::kernelsFor() {
+    return Kernels{&ParallelTreeBuilder::initDataN<N>,
+                   &ParallelTreeBuilder::parentsN<N>,
+                   &ParallelTreeBuilder::parentsBlockN<N>,
+                   &ParallelTreeBuilder::streamShareN<N>};
+}
+
+const ParallelTreeBuilder::Kernels& ParallelTreeBuilder::kernels(int n) {
+    static const Kernels table[kMaxDim + 1] = {
+        {}, {}, kernelsFor<2>(), kernelsFor<3>(), kernelsFor<4>(), kernelsFor<5>(),
+        kernelsFor<6>(), kernelsFor<7>(), kernelsFor<8>(), kernelsFor<9>(),
+        kernelsFor<10>(), kernelsFor<11>(), kernelsFor<12>()
+    };
+    return table[n];
+}
+
+template <int N>
+void ParallelTreeBuilder::initDataN() {
+    // Batches of rows from the flat store through the vector kernels;
+    // OpenMP hands whole batches to threads (first touch follows)
+    const size_t span = tableLast_ - tableFirst_;
+    const size_t batches = (span + kInitBatch - 1) / kInitBatch;
+    #pragma omp parallel for schedule(static)
+    for (size_t b = 0; b < batches; ++b) {
+        size_t lo = b * kInitBatch, count = std::min(kInitBatch, span - lo);
+        TableKernels::initRows<N>(elements_.row(lo), elements_.stride(), count,
+                                  packed_ + lo, locator_ + lo, mismatchPos_ + lo);
+    }
+}
+
+template <int N>
+void ParallelTreeBuilder::parentsN(int t, size_t first, size_t count, uint32_t* out) const {
+    constexpr size_t kBatch = ParentKernels::kBatch;
+    for (size_t k = 0; k < count; k += kBatch) {
+        size_t len = std::min(kBatch, count - k), i = first + k - tableFirst_;
+        ParentKernels::run<N, true>(t, t, packed_ + i, locator_ + i, mismatchPos_ + i,
+                                    uint32_t(first + k), len, 0, nullptr, out + k);
+    }
+    if (first == 0 && count > 0) out[0] = kNoParent;  // row 0 is the identity (root)
+}
+
+void ParallelTreeBuilder::parents(int tree, size_t first, size_t count, uint32_t* out) const {
+    (this->*kernels_->parents)(tree, first, count, out);
+}
+
+template <int N>
+void ParallelTreeBuilder::parentsBlockN(size_t lo, size_t hi, uint32_t* out, size_t stride) const {
+    // Threads take batches of vertices; a batch is decoded once and then
+    // runs every tree
+    constexpr size_t kBatch = ParentKernels::kBatch;
+    const size_t batches = (hi - lo + kBatch - 1) / kBatch;
     #pragma omp parallel for schedule(static)
-    for (size_t i = 0; i < count_; ++i) {
-        const auto &perm = elements_[i];
-        // Optimized inner loop - unrolled for small n
-        if (dim_ <= 8) {
-            for (int j = 0; j < dim_; ++j) {
-                locator_[i][perm[j]] = (uint8_t)j;
+    for (size_t b = 0; b < batches; ++b) {
+        size_t node = lo + b * kBatch, len = std::min(kBatch, hi - node);
+        size_t i = node - tableFirst_;
+        uint32_t* o = out + (node - lo);
+        ParentKernels::run<N, true>(1, N-1, packed_ + i, locator_ + i, mismatchPos_ + i,
+                                    uint32_t(node), len, stride, nullptr, o);
+        if (node == 0)  // row 0 is the identity (root)
+            for (int t = 1; t < N; ++t)
+                o[(t-1) * stride] = kNoParent;
+    }
+}
+
+template <int N>
+void ParallelTreeBuilder::streamShareN(size_t a, size_t b, size_t lo, uint8_t* buf, size_t perTree) const {
+    // Batches are unranked into 16-byte rows, decoded by TableKernels and
+    // run through ParentKernels; a and every batch start even, so no
+    // swap-code byte is split
+    constexpr size_t kBatch = ParentKernels::kBatch;
+    const bool codes = opts_.swapCodes;
+    alignas(kCacheLine) uint8_t rows[kBatch * 16];
+    PackedPerm perm[kBatch], loc[kBatch];
+    uint8_t mis[kBatch], pos[(N-1) * kBatch];
+    uint32_t par[(N-1) * kBatch];
+    uint8_t cur[16];
+    if (a < b) PermutationUtils::unrank(a, N, cur);
+    for (size_t node = a; node < b; node += kBatch) {
+        size_t len = std::min(kBatch, b - node), i = node - lo;
+        for (size_t k = 0; k < len; ++k) {
+            std::memcpy(rows + 16 * k, cur, N);
+            std::next_permutation(cur, cur + N);
+        }
+        TableKernels::initRows<N>(rows, 16, len, perm, loc, mis);
+        if (codes) {
+            ParentKernels::run<N, false>(1, N-1, perm, loc, mis, uint32_t(node), len, kBatch, pos, nullptr);
+            for (int t = 1; t < N; ++t) {
+                uint8_t* p = pos + (t-1) * kBatch;
+                if (node == 0) p[0] = SwapCode::kRoot;
+                uint8_t* out = buf + (t-1) * perTree + (i >> 1);
+                for (size_t k = 0; k < len; k += 2)
+                    out[k >> 1] = uint8_t(p[k] | p[k+1] << 4);
             }
         } else {
-            // Vectorizable loop for larger n
-            for (int j = 0; j < dim_; ++j) {
-                locator_[i][perm[j]] = (uint8_t)j;
+            ParentKernels::run<N, true>(1, N-1, perm, loc, mis, uint32_t(node), len, kBatch, nullptr, par);
+            for (int t = 1; t < N; ++t) {
+                uint32_t* p = par + (t-1) * kBatch;
+                if (node == 0) p[0] = kNoParent;
+                std::memcpy(buf + (t-1) * perTree + 4 * i, p, 4 * len);
             }
         }
-        
-        // More efficient first wrong computation
-        int k = dim_-1; 
-        while (k >= 0 && perm[k] == k+1) --k;
-        mismatchPos_[i] = (k < 0 ? 1 : (uint8_t)k);
     }
 }
 
-std::vector<uint8_t> ParallelTreeBuilder::slide(size_t idx, int sym) const {
-    const auto& curr = elements_[idx];
-    int pos = locator_[idx][sym];
-    if (pos < 0 || pos+1 >= dim_) return curr;
+void ParallelTreeBuilder::streamTrees(int rank, int worldSize) {
+    double start_time = MPI_Wtime();
     
-    // Create result with reserved capacity
-    std::vector<uint8_t> result(curr);
-    std::swap(result[pos], result[pos+1]);
-    return result;
-}
-
-std::vector<uint8_t> ParallelTreeBuilder::fallbackParent(size_t idx, int t) const {
-    auto cp = slide(idx, t);
-    if (t == 2 && cp == identity_) return slide(idx, t-1);
-    uint8_t pen = elements_[idx][dim_-2];
-    if (pen == t || pen == dim_-1) return slide(idx, mismatchPos_[idx]+1);
-    return cp;
-}
-
-uint32_t ParallelTreeBuilder::findParent(size_t node, int t) const {
-    const auto &perm = elements_[node];
-    uint8_t last = perm[dim_-1], prev = perm[dim_-2];
+    const int T = treeCount_;
+    const bool codes = opts_.swapCodes;
+    const std::string dir = "ist/" + std::to_string(dim_);
+    Checkpoint::Layout layout{dim_, T, count_, kStreamVertices, codes};
+    
+    // Blocks of the fixed grid still to do: all of them, or on resume those
+    // the journals do not vouch for. Rank 0 decides, everyone follows.
+    uint64_t B = layout.blocks();
+    std::vector<uint8_t> done(B, 0);
+    if (rank == 0) {
+        if (opts_.resume) done = Checkpoint::completedBlocks(dir, layout);
+        else Checkpoint::clear(dir);
+        IstWriter::path(dim_, 1);  // creates ist/<n>/
+    }
+    MPI_Bcast(done.data(), int(B), MPI_UINT8_T, 0, MPI_COMM_WORLD);
+    std::vector<uint64_t> pending;
+    for (uint64_t b = 0; b < B; ++b)
+        if (!done[b]) pending.push_back(b);
+    // contiguous share of the pending blocks, whatever the rank count
+    size_t pFirst, pLast;
+    vertexRange(pending.size(), rank, worldSize, pFirst, pLast);
+    Checkpoint journal(dir, rank, layout);
     
-    if (last == dim_) {
-        if (t != dim_-1) return indexOf_.at(PermutationUtils::toKey(fallbackParent(node,t)));
-        return indexOf_.at(PermutationUtils::toKey(slide(node, prev)));
+    // A block that did not fully reach the file must never be journaled:
+    // --resume would skip it and keep a corrupt tree, so the run stops here
+    auto writeFailed = [&](const std::string& what) {
+        std::cerr << "Rank " << rank << ": " << what << std::endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    };
+    
+    // Every rank writes its own blocks of every tree file at a fixed offset
+    std::vector<MPI_File> files(T);
+    for (int t = 1; t <= T; ++t) {
+        std::string path = IstWriter::path(dim_, t);
+        if (MPI_File_open(MPI_COMM_WORLD, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                          MPI_INFO_NULL, &files[t-1]) != MPI_SUCCESS)
+            writeFailed("failed to open file: " + path);
+        IstHeader h = IstHeader::make(dim_, t, count_, 0, codes ? kIstSwapCodes : 0);
+        MPI_File_set_size(files[t-1], MPI_Offset(h.fileSize()));
+        MPI_Status st;
+        int written = 0;
+        if (rank == 0 && (MPI_File_write_at(files[t-1], 0, &h, sizeof(h), MPI_BYTE, &st) != MPI_SUCCESS ||
+                          MPI_Get_count(&st, MPI_BYTE, &written) != MPI_SUCCESS || written != int(sizeof(h))))
+            writeFailed("failed to write the header of " + path);
     }
     
-    if (last == dim_-1 && prev == dim_ && slide(node, dim_) != identity_) {
-        auto alt = (t == 1 ? slide(node, dim_) : slide(node, t-1));
-        return indexOf_.at(PermutationUtils::toKey(alt));
+    // Two chunk buffers: the next block is computed while the previous
+    // one's writes are in flight; it is journaled once they complete
+    const size_t perTree = codes ? kStreamVertices / 2 : 4 * kStreamVertices;
+    std::vector<uint8_t> bufs[2];
+    std::vector<MPI_Request> reqs[2];
+    std::vector<uint64_t> sums[2];
+    int64_t inFlight[2] = {-1, -1};                // block in each slot
+    bool posted[2] = {true, true};                 // every write of the slot was started
+    std::vector<MPI_Status> statuses(T);
+    for (int s = 0; s < 2; ++s) {
+        bufs[s].resize(T * perTree);
+        reqs[s].assign(T, MPI_REQUEST_NULL);
+        sums[s].resize(T);
     }
+    auto retire = [&](int s) {
+        // Open MPI 4.1 crashes in its error handler when MPI_Wait(all)
+        // completes a failed file write, so each request is polled for its
+        // status and freed; a failed or short write shows in the count
+        bool ok = posted[s];
+        for (int t = 0; t < T; ++t) {
+            if (reqs[s][t] == MPI_REQUEST_NULL) continue;
+            int flag = 0;
+            while (!flag && MPI_Request_get_status(reqs[s][t], &flag, &statuses[t]) == MPI_SUCCESS) {}
+            if (flag) MPI_Request_free(&reqs[s][t]);
+            else ok = false;
+        }
+        if (inFlight[s] < 0) return;
+        uint64_t blk = uint64_t(inFlight[s]);
+        for (int t = 1; t <= T && ok; ++t) {
+            int written = 0;
+            ok = MPI_Get_count(&statuses[t-1], MPI_BYTE, &written) == MPI_SUCCESS &&
+                 uint64_t(written) == layout.bytes(blk);
+        }
+        if (!ok) writeFailed("writing block " + std::to_string(blk) + " failed or was short");
+        for (int t = 1; t <= T; ++t) journal.record(t, blk, sums[s][t-1]);
+        inFlight[s] = -1;
+    };
     
-    auto swp = (last == t ? slide(node, dim_) : slide(node, t));
-    return indexOf_.at(PermutationUtils::toKey(swp));
+    double compute_time = 0, wait_time = 0;
+    int slot = 0;
+    for (size_t k = pFirst; k < pLast; ++k) {
+        uint64_t blk = pending[k];
+        size_t lo = layout.first(blk), hi = layout.last(blk);
+        size_t len = hi - lo;                      // even: n! and the grid step are
+        
+        double wait_start = MPI_Wtime();
+        retire(slot);
+        double compute_start = MPI_Wtime();
+        wait_time += compute_start - wait_start;
+        
+        uint8_t* buf = bufs[slot].data();
+        #pragma omp parallel
+        {
+            // thread shares start on even vertices so no code byte is split
+            int nt = omp_get_num_threads(), tid = omp_get_thread_num();
+            size_t a = lo + 2 * ((len / 2) * tid / nt);
+            size_t b = lo + 2 * ((len / 2) * (tid + 1) / nt);
+            (this->*kernels_->streamShare)(a, b, lo, buf, perTree);
+        }
+        
+        int bytes = int(layout.bytes(blk));
+        #pragma omp parallel for schedule(static)
+        for (int t = 1; t <= T; ++t)
+            sums[slot][t-1] = Checkpoint::checksum(buf + (t-1) * perTree, size_t(bytes));
+        double compute_end = MPI_Wtime();
+        compute_time += compute_end - compute_start;
+        
+        posted[slot] = true;
+        for (int t = 1; t <= T; ++t)
+            posted[slot] &= MPI_File_iwrite_at(files[t-1], MPI_Offset(layout.offset(blk)), buf + (t-1) * perTree,
+                                               bytes, MPI_BYTE, &reqs[slot][t-1]) == MPI_SUCCESS;
+        inFlight[slot] = int64_t(blk);
+        slot ^= 1;
+    }
+    
+    double drain_start = MPI_Wtime();
+    retire(0);
+    retire(1);
+    for (MPI_File& fh : files)
+        MPI_File_close(&fh);
+    double end_time = MPI_Wtime();
+    wait_time += end_time - drain_start;
+    
+    uint64_t mine = pLast - pFirst, skipped = B - pending.size();
+    if (rank == 0) {
+        std::cout << "\nStreaming Timing (Rank 0):\n";
+        std::cout << std::fixed << std::setprecision(3);
+        std::cout << "Blocks: " << B << " total, " << skipped << " already complete, "
+                  << mine << " computed here\n";
+        std::cout << "Parent computation: " << compute_time << " seconds\n";
+        std::cout << "Waiting for writes: " << wait_time << " seconds\n";
+        std::cout << "Chunk buffers: " << (2.0 * T * perTree / (1024.0 * 1024.0)) << " MB\n";
+        std::cout << "Total streaming time: " << (end_time - start_time) << " seconds\n";
+    }
 }
 
-void ParallelTreeBuilder::generateEdges(const std::vector<int>& trees) {
+void ParallelTreeBuilder::vertexRange(size_t count, int rank, int worldSize, size_t& first, size_t& last) {
+    first = count * rank / worldSize;
+    last = count * (rank + 1) / worldSize;
+}
+
+void ParallelTreeBuilder::resetParents(size_t size) {
+    // Each tree's run is split over the threads the way the child index
+    // build reads it, so those pages are local to the threads using them
+    parent_.resize(size);
+    const size_t run = size / treeCount_;
+    uint32_t* p = parent_.data();
+    #pragma omp parallel
+    for (int t = 0; t < treeCount_; ++t) {
+        #pragma omp for schedule(static) nowait
+        for (size_t v = 0; v < run; ++v) p[t * run + v] = kNoParent;
+    }
+}
+
+void ParallelTreeBuilder::generateEdges() {
     double start_time = MPI_Wtime();
     
-    assignedTrees_ = trees;  // Store the assigned trees
-    size_t total = trees.size() * count_;
+    int rank, worldSize;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &worldSize);
+    size_t chunkWords = kChunkHeader + treeCount_ * kChunkVertices;
+    double poll_time = 0;
     
     double parallel_start = MPI_Wtime();
     
-    // Pre-allocate localList_ with estimated size
-    localList_.reserve(total);
-    
-    #pragma omp parallel
-    {
-        // Thread-local buffer for collecting edges
-        const int MAX_EDGES_PER_THREAD = 100000;
-        std::vector<std::tuple<int,uint32_t,uint32_t>> thread_edges;
-        thread_edges.reserve(MAX_EDGES_PER_THREAD);
+    if (opts_.collectiveOutput) {
+        // Parents stay on the rank that computed them
+        size_t span = last_ - first_;
+        resetParents(treeCount_ * span);
+        uint32_t* out = parent_.data();
+        (this->*kernels_->parentsBlock)(first_, last_, out, span);
+    } else if (rank == 0) {
+        // Full parent arrays; every vertex owns slot v of each, so threads
+        // write disjoint entries and the result is schedule-independent
+        resetParents(treeCount_ * count_);
+        uint32_t* out = parent_.data();
         
-        #pragma omp for schedule(dynamic, 1024)
-        for (size_t x = 0; x < total; ++x) {
-            size_t li = x / count_; 
-            size_t v = x % count_;
-            if (elements_[v] == identity_) continue;
+        // Chunks from the other ranks are received while rank 0 computes
+        for (int src = 1; src < worldSize; ++src) {
+            size_t lo, hi;
+            vertexRange(count_, src, worldSize, lo, hi);
+            chunksExpected_ += (hi - lo + kChunkVertices - 1) / kChunkVertices;
+        }
+        int depth = (int)std::min<uint64_t>(kRecvDepth, chunksExpected_);
+        chunkBufs_.assign(depth, std::vector<uint32_t>(chunkWords));
+        chunkReqs_.assign(depth, MPI_REQUEST_NULL);
+        for (int i = 0; i < depth; ++i) postChunkRecv(i);
+        
+        for (size_t lo = first_; lo < last_; lo += kChunkVertices) {
+            size_t hi = std::min(last_, lo + kChunkVertices);
+            (this->*kernels_->parentsBlock)(lo, hi, out + lo, count_);
             
-            uint32_t p = findParent(v, trees[li]);
+            double poll_start = MPI_Wtime();
+            while (pollChunks(false)) {}
+            poll_time += MPI_Wtime() - poll_start;
+        }
+    } else {
+        // Ring of send buffers: reuse a slot only once its Isend completed
+        chunkBufs_.assign(kSendDepth, std::vector<uint32_t>(chunkWords));
+        chunkReqs_.assign(kSendDepth, MPI_REQUEST_NULL);
+        int slot = 0;
+        for (size_t lo = first_; lo < last_; lo += kChunkVertices) {
+            size_t hi = std::min(last_, lo + kChunkVertices);
+            size_t len = hi - lo;
+            MPI_Wait(&chunkReqs_[slot], MPI_STATUS_IGNORE);
+            uint32_t* chunk = chunkBufs_[slot].data();
+            chunk[0] = uint32_t(lo);
+            chunk[1] = uint32_t(uint64_t(lo) >> 32);
+            chunk[2] = uint32_t(len);
+            chunk[3] = 0;
+            uint32_t* out = chunk + kChunkHeader;
             
-            // Store edge in thread-local buffer
-            thread_edges.emplace_back((int)li, p, (uint32_t)v);
+            (this->*kernels_->parentsBlock)(lo, hi, out, len);
             
-            // If buffer is full, flush to global list
-            if (thread_edges.size() >= MAX_EDGES_PER_THREAD) {
-                #pragma omp critical
-                {
-                    localList_.insert(localList_.end(), thread_edges.begin(), thread_edges.end());
-                }
-                thread_edges.clear();
-            }
-        }
-        
-        // Flush remaining edges
-        if (!thread_edges.empty()) {
-            #pragma omp critical
-            {
-                localList_.insert(localList_.end(), thread_edges.begin(), thread_edges.end());
-            }
+            MPI_Isend(chunk, int(kChunkHeader + treeCount_ * len), MPI_UINT32_T, 0, kChunkTag,
+                      MPI_COMM_WORLD, &chunkReqs_[slot]);
+            slot = (slot + 1) % kSendDepth;
         }
     }
     
@@ -166,137 +477,477 @@ void ParallelTreeBuilder::generateEdges(const std::vector<int>& trees) {
     
     double end_time = MPI_Wtime();
     
-    int rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     if (rank == 0) {
         std::cout << "\nEdge Generation Timing:\n";
         std::cout << std::fixed << std::setprecision(3);
-        std::cout << "Parallel computation time: " << (parallel_end - parallel_start) << " seconds\n";
+        std::cout << "Parallel computation time: " << (parallel_end - parallel_start - poll_time) << " seconds\n";
+        std::cout << "Overlapped chunk receive: " << poll_time << " seconds ("
+                  << chunksReceived_ << "/" << chunksExpected_ << " chunks)\n";
         std::cout << "Total edge generation time: " << (end_time - start_time) << " seconds\n";
     }
 }
 
-void ParallelTreeBuilder::assembleAndWrite(int rank, int worldSize) {
+void ParallelTreeBuilder::postChunkRecv(int slot) {
+    if (chunksPosted_ == chunksExpected_) return;
+    MPI_Irecv(chunkBufs_[slot].data(), (int)chunkBufs_[slot].size(), MPI_UINT32_T, MPI_ANY_SOURCE,
+              kChunkTag, MPI_COMM_WORLD, &chunkReqs_[slot]);
+    ++chunksPosted_;
+}
+
+bool ParallelTreeBuilder::pollChunks(bool block) {
+    if (chunksReceived_ == chunksExpected_) return false;
+    int slot, done = 0;
+    if (block) {
+        MPI_Waitany((int)chunkReqs_.size(), chunkReqs_.data(), &slot, MPI_STATUS_IGNORE);
+        done = 1;
+    } else {
+        MPI_Testany((int)chunkReqs_.size(), chunkReqs_.data(), &slot, &done, MPI_STATUS_IGNORE);
+    }
+    if (!done || slot == MPI_UNDEFINED) return false;
+    placeChunk(chunkBufs_[slot].data());
+    ++chunksReceived_;
+    postChunkRecv(slot);
+    return true;
+}
+
+void ParallelTreeBuilder::placeChunk(const uint32_t* chunk) {
+    size_t lo = size_t(chunk[0]) | (size_t(chunk[1]) << 32);
+    size_t len = chunk[2];
+    const uint32_t* in = chunk + kChunkHeader;
+    for (int t = 1; t <= treeCount_; ++t)
+        std::copy(in + (t-1) * len, in + t * len, parent_.begin() + (t-1) * count_ + lo);
+}
+
+void ParallelTreeBuilder::placeParents(int tree, const uint32_t* parents) {
+    globalKids_[tree-1].build(parents, count_, kNoParent);
+}
+
+void ParallelTreeBuilder::localityReport() const {
+    if (parent_.size() != size_t(treeCount_) * count_) return;  // rank 0, gathered parents only
+    std::cout << "\nVertex order locality (child vs parent index):\n";
+    std::cout << std::fixed << std::setprecision(3);
+    std::vector<uint32_t> relabeled(count_);
+    for (VertexOrder::Kind kind : {VertexOrder::Kind::Lex, VertexOrder::Kind::Sjt}) {
+        double order_start = MPI_Wtime();
+        VertexOrder order(dim_, kind);
+        double order_time = MPI_Wtime() - order_start;
+        double build_time = 0;
+        std::cout << VertexOrder::name(kind) << " (translation tables " << order_time << " seconds)\n";
+        for (int t = 1; t <= treeCount_; ++t) {
+            const uint32_t* parents = parent_.data() + (t-1) * count_;
+            VertexOrder::Locality loc = order.locality(parents, kNoParent);
+            order.relabel(parents, relabeled.data(), kNoParent);
+            double build_start = MPI_Wtime();
+            ChildIndex kids;
+            kids.build(relabeled.data(), count_, kNoParent);
+            build_time += MPI_Wtime() - build_start;
+            double misses = VertexOrder::indexBuildMisses(relabeled.data(), count_, kNoParent);
+            std::cout << "  tree " << t << ": mean log2 distance " << loc.meanLog2Distance
+                      << ", same cache line " << loc.sameLine << ", same page " << loc.samePage
+                      << ", simulated index build misses per vertex " << misses << "\n";
+        }
+        std::cout << "  child index build, all trees: " << build_time << " seconds\n";
+    }
+}
+
+bool ParallelTreeBuilder::assembleAndWrite(int rank, int worldSize) {
     double start_time = MPI_Wtime();
     
     int T = treeCount_;
-    if (rank == 0) {
-        // place local edges
-        double local_start = MPI_Wtime();
-        for (auto &e: localList_) {
-            int li; uint32_t p,c; std::tie(li,p,c)=e;
-            globalKids_[assignedTrees_[li]-1][p].push_back(c);
+    if (opts_.collectiveOutput) {
+        double write_start = MPI_Wtime();
+        bool ok = true;
+        for (int t = 1; t <= T; ++t) {
+            if (opts_.binaryOutput) ok = writeIstCollective(t, rank, worldSize) && ok;
+            else ok = writeDotCollective(t, rank, worldSize) && ok;
         }
-        double local_end = MPI_Wtime();
+        double write_end = MPI_Wtime();
         
-        // gather from others
+        if (rank == 0) {
+            std::cout << "\nAssembly and Write Timing (collective):\n";
+            std::cout << std::fixed << std::setprecision(3);
+            std::cout << (opts_.binaryOutput ? "Writing .ist files (MPI-IO): " : "Writing DOT files (MPI-IO): ")
+                      << (write_end - write_start) << " seconds\n";
+        }
+        return ok;
+    } else if (rank == 0) {
+        // chunks that did not arrive while rank 0 was computing
         double gather_start = MPI_Wtime();
-        for (int src=1; src<worldSize; ++src) {
-            // First receive the number of trees this process has
-            int numTrees;
-            MPI_Recv(&numTrees, 1, MPI_INT, src, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            
-            // Receive the tree indices this process is handling
-            std::vector<int> treeIndices(numTrees);
-            MPI_Recv(treeIndices.data(), numTrees, MPI_INT, src, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            
-            // For each tree this process handles
-            for (int i = 0; i < numTrees; ++i) {
-                int treeIdx = treeIndices[i];
-                int countMsg;
-                MPI_Recv(&countMsg, 1, MPI_INT, src, treeIdx, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                
-                if (countMsg > 0) {
-                    std::vector<uint32_t> buf(2*countMsg);
-                    MPI_Recv(buf.data(), 2*countMsg, MPI_UINT32_T, src, treeIdx+T, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                    
-                    for (int j=0; j<countMsg; ++j) {
-                        globalKids_[treeIdx-1][buf[2*j]].push_back(buf[2*j+1]);
-                    }
-                }
+        while (pollChunks(true)) {}
+        double gather_end = MPI_Wtime();
+        
+        globalKids_.assign(T, ChildIndex(&arena_));
+        if (opts_.asyncOutput && !opts_.binaryOutput) {
+            // The writer thread flushes tree t while tree t+1 is indexed and formatted
+            double keys_start = MPI_Wtime();
+            renderKeys();
+            double keys_end = MPI_Wtime();
+            AsyncWriter writer(2 * size_t(omp_get_max_threads()) + 2,
+                               kDotBlockVertices * (dim_ - 1) * edgeLineLength(dim_));
+            bool ok = true;
+            for (int t = 1; t <= T; ++t) {
+                placeParents(t, parent_.data() + (t-1) * count_);
+                ok &= writeDots(t, t, &writer);
             }
+            writer.drain();
+            double end_time = MPI_Wtime();
+            if (ok && !writer.ok()) {
+                std::cerr << "Error writing DOT files" << std::endl;
+                ok = false;
+            }
+            
+            double busy = writer.busySeconds(), waited = writer.waitSeconds();
+            std::cout << "\nAssembly and Write Timing (Rank 0, async writer):\n";
+            std::cout << std::fixed << std::setprecision(3);
+            std::cout << "Gathering remaining chunks: " << (gather_end - gather_start) << " seconds\n";
+            std::cout << "Key table render: " << (keys_end - keys_start) << " seconds\n";
+            std::cout << "Child index build + DOT write: " << (end_time - keys_end) << " seconds\n";
+            std::cout << "Writer thread busy: " << busy << " seconds, waited for writer: " << waited
+                      << " seconds, I/O hidden: " << std::max(0.0, busy - waited) << " seconds\n";
+            std::cout << "Total assembly and write time: " << (end_time - start_time) << " seconds\n";
+            return ok;
         }
-        double gather_end = MPI_Wtime();
         
-        // write DOTs
+        // CSR children of every tree
+        double index_start = MPI_Wtime();
+        for (int t = 1; t <= T; ++t)
+            placeParents(t, parent_.data() + (t-1) * count_);
+        double index_end = MPI_Wtime();
+        
+        // write DOTs (or binary trees)
         double write_start = MPI_Wtime();
-        for (int t=1; t<=T; ++t)
-            writeDot(t, globalKids_[t-1]);
+        double keys_time = 0;
+        bool ok = true;
+        if (!opts_.binaryOutput) {
+            renderKeys();
+            keys_time = MPI_Wtime() - write_start;
+            ok = writeDots(1, T, nullptr);
+        }
+        for (int t=1; t<=T && opts_.binaryOutput; ++t) {
+            if (opts_.swapCodes)
+                ok = IstWriter::writeSwapCodes(IstWriter::path(dim_, t), dim_, t, 0,
+                                               parent_.data() + (t-1) * count_, count_) && ok;
+            else
+                ok = IstWriter::write(IstWriter::path(dim_, t), dim_, t, 0,
+                                      parent_.data() + (t-1) * count_, count_, &globalKids_[t-1]) && ok;
+        }
         double write_end = MPI_Wtime();
         
         double end_time = MPI_Wtime();
         
         std::cout << "\nAssembly and Write Timing (Rank 0):\n";
         std::cout << std::fixed << std::setprecision(3);
-        std::cout << "Local edge placement: " << (local_end - local_start) << " seconds\n";
-        std::cout << "Gathering from other ranks: " << (gather_end - gather_start) << " seconds\n";
-        std::cout << "Writing DOT files: " << (write_end - write_start) << " seconds\n";
+        std::cout << "Gathering remaining chunks: " << (gather_end - gather_start) << " seconds\n";
+        std::cout << "Child index build: " << (index_end - index_start) << " seconds\n";
+        if (!opts_.binaryOutput)
+            std::cout << "Key table render: " << keys_time << " seconds\n";
+        std::cout << (opts_.binaryOutput ? "Writing .ist files: " : "Writing DOT files: ")
+                  << (write_end - write_start) << " seconds\n";
         std::cout << "Total assembly and write time: " << (end_time - start_time) << " seconds\n";
+        return ok;
     } else {
         double send_start = MPI_Wtime();
         
-        // Send number of trees this process handles
-        int numTrees = assignedTrees_.size();
-        MPI_Send(&numTrees, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
-        
-        // Send the tree indices this process handles
-        MPI_Send(assignedTrees_.data(), numTrees, MPI_INT, 0, 1, MPI_COMM_WORLD);
-        
-        // Group edges by tree
-        std::vector<std::vector<std::pair<uint32_t, uint32_t>>> treeEdges(numTrees);
-        for (auto &e: localList_) {
-            int li; uint32_t p,c; std::tie(li,p,c)=e;
-            treeEdges[li].emplace_back(p, c);
-        }
-        
-        // Send edges for each tree
-        for (int i = 0; i < numTrees; ++i) {
-            int treeIdx = assignedTrees_[i];
-            int cnt = treeEdges[i].size();
-            MPI_Send(&cnt, 1, MPI_INT, 0, treeIdx, MPI_COMM_WORLD);
-            
-            if (cnt > 0) {
-                std::vector<uint32_t> buf(2*cnt);
-                for (int j = 0; j < cnt; ++j) {
-                    buf[2*j] = treeEdges[i][j].first;
-                    buf[2*j+1] = treeEdges[i][j].second;
-                }
-                MPI_Send(buf.data(), 2*cnt, MPI_UINT32_T, 0, treeIdx+T, MPI_COMM_WORLD);
-            }
-        }
+        // Wait for the chunks still in flight
+        MPI_Waitall((int)chunkReqs_.size(), chunkReqs_.data(), MPI_STATUSES_IGNORE);
         double send_end = MPI_Wtime();
         
         std::cout << "\nAssembly Timing (Rank " << rank << "):\n";
         std::cout << std::fixed << std::setprecision(3);
         std::cout << "Sending data to rank 0: " << (send_end - send_start) << " seconds\n";
     }
+    return true;
+}
+
+std::string ParallelTreeBuilder::dotPath(int tree) const {
+    return "dot/" + std::to_string(dim_) + "/Tree_" + std::to_string(dim_) + "_" + std::to_string(tree) + ".dot";
+}
+
+std::string ParallelTreeBuilder::dotHeader(int tree) const {
+    return "digraph Tree" + std::to_string(dim_) + "_" + std::to_string(tree) + " {\n    rankdir = LR;\n";
+}
+
+size_t ParallelTreeBuilder::formatEdge(char* out, const uint8_t* p, const uint8_t* c, int n) {
+    char* o = out;
+    for (int i = 0; i < 4; ++i) *o++ = ' ';
+    *o++ = '"';
+    for (int i = 0; i < n; ++i) *o++ = PermutationUtils::symbolChar(p[i]);
+    for (char ch : {'"', ' ', '-', '>', ' ', '"'}) *o++ = ch;
+    for (int i = 0; i < n; ++i) *o++ = PermutationUtils::symbolChar(c[i]);
+    for (char ch : {'"', ';', '\n'}) *o++ = ch;
+    return size_t(o - out);
+}
+
+int ParallelTreeBuilder::ownerOf(size_t v, int worldSize) const {
+    // invert vertexRange: largest r with count_*r/worldSize <= v
+    int r = int((v * worldSize) / count_);
+    while (r + 1 < worldSize && count_ * (r + 1) / worldSize <= v) ++r;
+    while (r > 0 && count_ * r / worldSize > v) --r;
+    return r;
 }
 
-void ParallelTreeBuilder::writeDot(int tree, const std::vector<std::vector<uint32_t>>& kids) const {
+bool ParallelTreeBuilder::writeDotCollective(int tree, int rank, int worldSize) {
+    size_t span = last_ - first_;
+    const uint32_t* parents = parent_.data() + (tree-1) * span;
+    
+    // Bucket local (parent, child) edges by the rank owning the parent
+    std::vector<int> sendCounts(worldSize, 0), recvCounts(worldSize);
+    std::vector<int> owner(span);
+    for (size_t i = 0; i < span; ++i) {
+        if (parents[i] == kNoParent) { owner[i] = -1; continue; }
+        owner[i] = ownerOf(parents[i], worldSize);
+        sendCounts[owner[i]]++;
+    }
+    std::vector<int> sendDispl(worldSize, 0), recvDispl(worldSize, 0);
+    for (int r = 1; r < worldSize; ++r) sendDispl[r] = sendDispl[r-1] + sendCounts[r-1];
+    std::vector<uint32_t> sendBuf(2 * size_t(sendDispl[worldSize-1] + sendCounts[worldSize-1]));
+    std::vector<int> cursor(sendDispl);
+    for (size_t i = 0; i < span; ++i) {
+        if (owner[i] < 0) continue;
+        size_t e = cursor[owner[i]]++;
+        sendBuf[2*e] = parents[i];
+        sendBuf[2*e + 1] = uint32_t(first_ + i);
+    }
+    
+    MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    for (int r = 1; r < worldSize; ++r) recvDispl[r] = recvDispl[r-1] + recvCounts[r-1];
+    size_t numEdges = size_t(recvDispl[worldSize-1]) + recvCounts[worldSize-1];
+    std::vector<uint32_t> recvBuf(2 * numEdges);
+    MPI_Datatype edgeType;
+    MPI_Type_contiguous(2, MPI_UINT32_T, &edgeType);
+    MPI_Type_commit(&edgeType);
+    MPI_Alltoallv(sendBuf.data(), sendCounts.data(), sendDispl.data(), edgeType,
+                  recvBuf.data(), recvCounts.data(), recvDispl.data(), edgeType, MPI_COMM_WORLD);
+    MPI_Type_free(&edgeType);
+    
+    // Children of the owned parents, sorted as the serial writer emits them
+    ChildIndex kids;
+    kids.buildFromEdges(recvBuf.data(), numEdges, first_, span);
+    
+    // Every line has the same width, so each rank's byte range follows
+    // from the number of edges owned by lower ranks
+    uint64_t localEdges = numEdges, edgesBefore = 0;
+    MPI_Exscan(&localEdges, &edgesBefore, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) edgesBefore = 0;
+    
+    std::string header = dotHeader(tree), footer = "}\n";
+    size_t lineLen = edgeLineLength(dim_);
+    size_t lead = (rank == 0 ? header.size() : 0);
+    size_t tail = (rank == worldSize - 1 ? footer.size() : 0);
+    std::vector<char> buf(lead + numEdges * lineLen + tail);
+    std::copy(header.begin(), header.begin() + lead, buf.begin());
+    #pragma omp parallel for schedule(dynamic, 4096)
+    for (size_t i = 0; i < span; ++i) {
+        if (kids.degree(i) == 0) continue;
+        uint8_t pp[16], cp[16];
+        PermutationUtils::unrank(first_ + i, dim_, pp);
+        char* o = buf.data() + lead + size_t(kids.offsets[i]) * lineLen;
+        for (const uint32_t* c = kids.begin(i); c != kids.end(i); ++c) {
+            PermutationUtils::unrank(*c, dim_, cp);
+            o += formatEdge(o, pp, cp, dim_);
+        }
+    }
+    std::copy(footer.begin(), footer.begin() + tail, buf.end() - tail);
+    
+    if (rank == 0) std::filesystem::create_directories("dot/" + std::to_string(dim_));
+    MPI_Barrier(MPI_COMM_WORLD);
+    
+    MPI_File fh;
+    std::string path = dotPath(tree);
+    if (!openAll(path, fh)) return false;
+    MPI_Offset total = MPI_Offset(header.size() + (count_ - 1) * lineLen + footer.size());
+    bool ok = MPI_File_set_size(fh, total) == MPI_SUCCESS;
+    
+    MPI_Offset offset = (rank == 0 ? 0 : MPI_Offset(header.size() + edgesBefore * lineLen));
+    ok = writeAtAll(fh, offset, buf.data(), buf.size()) && ok;
+    ok = MPI_File_close(&fh) == MPI_SUCCESS && ok;
+    if (!allRanks(ok)) {
+        if (rank == 0) std::cerr << "Error writing " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool ParallelTreeBuilder::writeIstCollective(int tree, int rank, int worldSize) {
+    if (rank == 0) IstWriter::path(dim_, tree);  // creates ist/<n>/
+    MPI_Barrier(MPI_COMM_WORLD);
+    
+    MPI_File fh;
+    std::string path = IstWriter::path(dim_, tree);
+    if (!openAll(path, fh)) return false;
+    // Parents only: the child index would need every rank's edges
+    IstHeader h = IstHeader::make(dim_, tree, count_, 0, opts_.swapCodes ? kIstSwapCodes : 0);
+    bool ok = MPI_File_set_size(fh, MPI_Offset(h.fileSize())) == MPI_SUCCESS;
+    if (rank == 0) {
+        MPI_Status st;
+        int written = 0;
+        ok = MPI_File_write_at(fh, 0, &h, sizeof(h), MPI_BYTE, &st) == MPI_SUCCESS &&
+             MPI_Get_count(&st, MPI_BYTE, &written) == MPI_SUCCESS && written == int(sizeof(h)) && ok;
+    }
+    auto finish = [&]() {
+        ok = MPI_File_close(&fh) == MPI_SUCCESS && ok;
+        if (allRanks(ok)) return true;
+        if (rank == 0) std::cerr << "Error writing " << path << std::endl;
+        return false;
+    };
+    
+    size_t span = last_ - first_;
+    const uint32_t* parents = parent_.data() + (tree-1) * span;
+    if (!opts_.swapCodes) {
+        MPI_Offset offset = MPI_Offset(h.parentOffset() + 4 * first_);
+        ok = writeAtAll(fh, offset, reinterpret_cast<const char*>(parents), 4 * span) && ok;
+        return finish();
+    }
+    
+    // Byte j packs vertices 2j and 2j+1 and is written by the owner of 2j+1,
+    // so a block starting on an odd vertex borrows the previous rank's last code
+    std::vector<uint8_t> code(span + 1);         // code[0] = vertex first_-1
+    SwapCode::encodeRange(parents, first_, span, dim_, code.data() + 1);
+    uint8_t lastCode = code[span];
+    std::vector<uint8_t> lastCodes(worldSize);
+    MPI_Allgather(&lastCode, 1, MPI_UINT8_T, lastCodes.data(), 1, MPI_UINT8_T, MPI_COMM_WORLD);
+    if (first_ & 1) code[0] = lastCodes[ownerOf(first_ - 1, worldSize)];
+    
+    size_t lo = first_ / 2, hi = last_ / 2;
+    std::vector<uint8_t> packed(hi - lo);
+    SwapCode::pack(code.data() + ((first_ & 1) ? 0 : 1), 2 * (hi - lo), packed.data());
+    ok = writeAtAll(fh, MPI_Offset(h.parentOffset() + lo), reinterpret_cast<const char*>(packed.data()),
+                    packed.size()) && ok;
+    return finish();
+}
+
+bool ParallelTreeBuilder::openAll(const std::string& path, MPI_File& fh) {
+    bool opened = MPI_File_open(MPI_COMM_WORLD, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                                MPI_INFO_NULL, &fh) == MPI_SUCCESS;
+    if (allRanks(opened)) return true;
+    if (opened) MPI_File_close(&fh);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank == 0) std::cerr << "Failed to open file: " << path << std::endl;
+    return false;
+}
+
+bool ParallelTreeBuilder::writeAtAll(MPI_File fh, MPI_Offset offset, const char* data, size_t bytes) {
+    // write_at_all takes an int count: split into pieces, same number on
+    // every rank; every piece is still written after a failure, since the
+    // other ranks are in the same collective call
+    const size_t kMaxPiece = size_t(1) << 30;
+    uint64_t pieces = (bytes + kMaxPiece - 1) / kMaxPiece;
+    MPI_Allreduce(MPI_IN_PLACE, &pieces, 1, MPI_UINT64_T, MPI_MAX, MPI_COMM_WORLD);
+    size_t done = 0;
+    bool ok = true;
+    for (uint64_t k = 0; k < pieces; ++k) {
+        size_t len = std::min(kMaxPiece, bytes - done);
+        MPI_Status st;
+        int written = 0;
+        ok = MPI_File_write_at_all(fh, offset + MPI_Offset(done), data + done, int(len), MPI_CHAR, &st) == MPI_SUCCESS &&
+             MPI_Get_count(&st, MPI_CHAR, &written) == MPI_SUCCESS && size_t(written) == len && ok;
+        done += len;
+    }
+    return ok;
+}
+
+bool ParallelTreeBuilder::allRanks(bool ok) {
+    int all = ok;
+    MPI_Allreduce(MPI_IN_PLACE, &all, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    return all != 0;
+}
+
+void ParallelTreeBuilder::renderKeys() {
+    keys_.resize(count_ * dim_);
+    #pragma omp parallel
+    {
+        // each thread unranks the start of its share, then steps in order
+        int nt = omp_get_num_threads(), tid = omp_get_thread_num();
+        size_t lo = count_ * tid / nt, hi = count_ * (tid + 1) / nt;
+        uint8_t perm[16];
+        if (lo < hi) PermutationUtils::unrank(lo, dim_, perm);
+        for (size_t v = lo; v < hi; ++v) {
+            char* k = keys_.data() + v * dim_;
+            for (int i = 0; i < dim_; ++i) k[i] = PermutationUtils::symbolChar(perm[i]);
+            std::next_permutation(perm, perm + dim_);
+        }
+    }
+}
+
+size_t ParallelTreeBuilder::formatKeyEdge(char* out, const char* p, const char* c, int n) {
+    char* o = out;
+    std::memcpy(o, "    \"", 5); o += 5;
+    std::memcpy(o, p, n); o += n;
+    std::memcpy(o, "\" -> \"", 6); o += 6;
+    std::memcpy(o, c, n); o += n;
+    std::memcpy(o, "\";\n", 3); o += 3;
+    return size_t(o - out);
+}
+
+static bool pwriteAll(int fd, const char* data, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t w = pwrite(fd, data, len, offset);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        data += w; len -= size_t(w); offset += w;
+    }
+    return true;
+}
+
+bool ParallelTreeBuilder::writeDots(int firstTree, int lastTree, AsyncWriter* writer) const {
     // Create dot directory and subdirectory for this n
-    std::string dotDir = "dot/" + std::to_string(dim_);
-    std::filesystem::create_directories(dotDir);
-    
-    std::string filename = dotDir + "/Tree_" + std::to_string(dim_) + "_" + std::to_string(tree) + ".dot";
-    std::ofstream os(filename);
-    os << "digraph Tree" << dim_ << "_" << tree << " {\n";
-    os << "    rankdir = LR;\n";
-    
-    // Pre-allocate string buffer for better performance
-    std::string edge_str;
-    edge_str.reserve(100);  // Typical edge string size
-    
-    for (uint32_t p=0; p<count_; ++p) {
-        if (kids[p].empty()) continue;
-        for (auto c: kids[p]) {
-            edge_str.clear();
-            edge_str = "    \"";
-            edge_str += PermutationUtils::toKey(elements_[p]);
-            edge_str += "\" -> \"";
-            edge_str += PermutationUtils::toKey(elements_[c]);
-            edge_str += "\";\n";
-            os << edge_str;
+    std::filesystem::create_directories("dot/" + std::to_string(dim_));
+    
+    // Lines are fixed width, so every block of parents has a known file
+    // offset: header + (edges before it) * lineLen. Open every tree up front.
+    const int T = lastTree - firstTree + 1;
+    const size_t lineLen = edgeLineLength(dim_);
+    std::vector<int> fds(T, -1);
+    std::vector<size_t> headerLen(T);
+    bool ok = true;
+    for (int i = 0; i < T; ++i) {
+        int t = firstTree + i;
+        std::string path = dotPath(t), header = dotHeader(t), footer = "}\n";
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            std::cerr << "Failed to open file: " << path << std::endl;
+            ok = false;
+            continue;
+        }
+        fds[i] = fd;
+        headerLen[i] = header.size();
+        ok &= pwriteAll(fd, header.data(), header.size(), 0);
+        ok &= pwriteAll(fd, footer.data(), footer.size(), off_t(header.size() + (count_ - 1) * lineLen));
+    }
+    
+    // Work items interleave the trees so threads write several files at once
+    const size_t blocks = (count_ + kDotBlockVertices - 1) / kDotBlockVertices;
+    const size_t items = blocks * T;
+    #pragma omp parallel reduction(&&:ok)
+    {
+        std::vector<char> buf;
+        #pragma omp for schedule(dynamic, 1)
+        for (size_t item = 0; item < items; ++item) {
+            int i = int(item % T);
+            if (fds[i] < 0) continue;
+            size_t lo = (item / T) * kDotBlockVertices;
+            size_t hi = std::min(count_, lo + kDotBlockVertices);
+            const ChildIndex& kids = globalKids_[firstTree - 1 + i];
+            size_t e0 = kids.offsets[lo], e1 = kids.offsets[hi];
+            if (writer) buf = writer->acquire();
+            buf.resize((e1 - e0) * lineLen);
+            char* o = buf.data();
+            for (size_t p = lo; p < hi; ++p) {
+                const char* pk = keys_.data() + p * dim_;
+                for (const uint32_t* c = kids.begin(p); c != kids.end(p); ++c)
+                    o += formatKeyEdge(o, pk, keys_.data() + size_t(*c) * dim_, dim_);
+            }
+            off_t offset = off_t(headerLen[i] + e0 * lineLen);
+            if (writer) writer->submit(fds[i], offset, std::move(buf));
+            else ok = pwriteAll(fds[i], buf.data(), buf.size(), offset) && ok;
         }
     }
-    os << "}\n";
+    for (int fd : fds) {
+        if (fd < 0) continue;
+        if (writer) writer->closeAfter(fd);
+        else close(fd);
+    }
+    if (!ok) std::cerr << "Error writing DOT files" << std::endl;
+    return ok;
 }
@@ -2,45 +2,179 @@
 #define TREE_BUILDER_HPP
 
 #include <vector>
-#include <tuple>
 #include <cstdint>
 #include <string>
-#include <unordered_map>
+#include "permutation_utils.hpp"
+#include "packed_perm.hpp"
+#include "child_index.hpp"
+#include "arena.hpp"
+#include "async_writer.hpp"
+#include <mpi.h>
 
 // Constructs n-1 spanning trees on B_n using MPI + OpenMP
 class ParallelTreeBuilder {
 public:
-    explicit ParallelTreeBuilder(int dimension);
+    struct Options {
+        // Build the per-vertex tables once per node in an MPI shared-memory
+        // window covering every rank on the node; other ranks map it read-only
+        bool sharedTables = false;
+        // Every rank writes its own parents' lines of each DOT file with
+        // MPI-IO instead of gathering all parents on rank 0
+        bool collectiveOutput = false;
+        // Write binary .ist trees (ist_format.hpp) instead of DOT
+        bool binaryOutput = false;
+        // .ist trees hold 4-bit swap codes instead of parent indices
+        bool swapCodes = false;
+        // Rank 0 hands DOT buffers to a writer thread (async_writer.hpp)
+        // and indexes the next tree while the previous one is flushed
+        bool asyncOutput = false;
+        // No per-vertex tables: walk vertex blocks by unranking and write
+        // .ist parents (or swap codes) block by block; memory stays bounded
+        // by the block size, which makes n = 11, 12 feasible. Blocks come
+        // from a fixed grid shared out among the ranks (checkpoint.hpp).
+        bool streaming = false;
+        // Streaming: keep the blocks the journals record as complete
+        bool resume = false;
+        // Tables from the hugetlbfs pool (MAP_HUGETLB) where it has room;
+        // otherwise, and by default, transparent huge pages (arena.hpp)
+        bool explicitHugePages = false;
+    };
 
-    // Parallel: produce parent-child tuples for assigned tree indices
-    void generateEdges(const std::vector<int>& trees);
-    // Collate edges from all ranks and emit GraphViz DOT
-    void assembleAndWrite(int rank, int worldSize);
+    // Tables are built only for the owned vertex block [first, last)
+    ParallelTreeBuilder(int dimension, size_t first, size_t last, const Options& opts);
+    ~ParallelTreeBuilder();
+    ParallelTreeBuilder(const ParallelTreeBuilder&) = delete;
+    ParallelTreeBuilder& operator=(const ParallelTreeBuilder&) = delete;
+
+    static constexpr uint32_t kNoParent = UINT32_MAX;  // parent of the root
+
+    // Contiguous share [first, last) of the n! vertices owned by a rank;
+    // every rank gets the same number of vertices to within one
+    static void vertexRange(size_t count, int rank, int worldSize, size_t& first, size_t& last);
+    size_t vertexCount() const { return count_; }
+
+    // Parallel: fill the parent array of every tree for the owned block
+    void generateEdges();
+    // Drain the remaining chunks on rank 0 and emit GraphViz DOT; false
+    // on rank 0 when a DOT file could not be written
+    bool assembleAndWrite(int rank, int worldSize);
+    // Streaming mode: compute and write this rank's share of the blocks
+    // still missing, journaling each one once it is on disk
+    void streamTrees(int rank, int worldSize);
+    // Parents in tree t of the vertices [first, first+count), which must
+    // lie in this rank's tables; kNoParent for the root. The rules run as
+    // masks over batches of ParentKernels::kBatch vertices.
+    void parents(int tree, size_t first, size_t count, uint32_t* out) const;
+    // Rank 0 after assembleAndWrite without --mpiio: for each vertex order
+    // (vertex_order.hpp), how close children sit to their parents in every
+    // tree and how long the child index takes to build in that numbering
+    void localityReport() const;
 
 private:
     int dim_;                            // permutation length n
     size_t count_;                       // n! vertices
     int treeCount_;                      // n-1 trees
-    std::vector<std::vector<uint8_t>> elements_;  // all perms
-    std::vector<std::vector<uint8_t>> locator_;   // position lookup
-    std::vector<uint8_t> mismatchPos_;            // first mismatch
-    std::vector<uint8_t> identity_;               // [1..n]
-    std::unordered_map<std::string,size_t> indexOf_; // perm -> idx
-    std::vector<int> assignedTrees_;          // tree indices assigned to this rank
-
-    // temporary storage of (treeIdxLocal, parentIdx, childIdx)
-    std::vector<std::tuple<int,uint32_t,uint32_t>> localList_;
-    // global children: trees->[parent]->vector<child>
-    std::vector<std::vector<std::vector<uint32_t>>> globalKids_;
+    Options opts_;
+    size_t first_, last_;                // vertex block owned by this rank
+    // Per-vertex tables cover [tableFirst_, tableLast_): the owned block,
+    // or the union of the node's blocks with shared tables. Index v - tableFirst_.
+    size_t tableFirst_, tableLast_;
+    PermTable elements_;                          // perms, one row each
+    PackedPerm* packed_ = nullptr;                // perms, 4 bits/symbol
+    PackedPerm* locator_ = nullptr;               // packed inverse (position lookup)
+    uint8_t* mismatchPos_ = nullptr;              // first mismatch
+    PackedPerm identity_;                         // [1..n]
+
+    // Backing memory of the tables above and of every other large table
+    // (parents, child indexes, keys); declared first so it is freed last
+    Arena arena_;                                 // private tables
+    MPI_Comm nodeComm_ = MPI_COMM_NULL;           // shared tables
+    MPI_Win tableWin_ = MPI_WIN_NULL;
+
+    // rank 0 only: parent_[(t-1)*count_ + v] = parent of v in tree t
+    // collective output: parent_[(t-1)*(last_-first_) + v-first_] on every rank
+    ArenaVector<uint32_t> parent_;
+    // parent_ = size entries of kNoParent, first touched by the threads
+    // that compute them (same static split as parentsBlockN)
+    void resetParents(size_t size);
+
+    // Streaming gather. Each rank's block travels to rank 0 in chunks of
+    // at most kChunkVertices vertices: a 4-word header (first vertex as two
+    // 32-bit halves, vertex count, unused) followed by one run of parents
+    // per tree. Sends start as soon as a chunk is computed.
+    static constexpr size_t kChunkVertices = size_t(1) << 16;
+    static constexpr int kChunkHeader = 4;
+    static constexpr int kChunkTag = 100;
+    static constexpr int kSendDepth = 4;          // chunks in flight per sender
+    static constexpr int kRecvDepth = 8;          // receives posted on rank 0
+    std::vector<std::vector<uint32_t>> chunkBufs_;
+    std::vector<MPI_Request> chunkReqs_;
+    uint64_t chunksExpected_ = 0, chunksPosted_ = 0, chunksReceived_ = 0;
+    // rank 0 only: CSR children of every tree, trees->[parent]->children
+    std::vector<ChildIndex> globalKids_;
 
     // Setup structures
-    void initData();
-    // Compute parent of node for tree t
-    uint32_t findParent(size_t node, int t) const;
-    std::vector<uint8_t> slide(size_t idx, int sym) const;
-    std::vector<uint8_t> fallbackParent(size_t idx, int t) const;
-    // write one DOT file
-    void writeDot(int tree, const std::vector<std::vector<uint32_t>>& kids) const;
+    uint8_t* allocateTables(size_t bytes, bool shared);
+    // Per-vertex kernels, specialised on n: with N a constant the packed
+    // permutation loops have fixed trip counts and unroll
+    template <int N> void initDataN();
+    static constexpr size_t kInitBatch = 4096;    // rows per TableKernels call
+    // parents() for n = N, through ParentKernels in batches
+    template <int N> void parentsN(int t, size_t first, size_t count, uint32_t* out) const;
+    // Parent of every node in [lo, hi) in every tree t, written to
+    // out[(t-1)*stride + node-lo] (OpenMP inside)
+    template <int N> void parentsBlockN(size_t lo, size_t hi, uint32_t* out, size_t stride) const;
+    // Streaming: vertices [a, b) of the block starting at lo, unranked here
+    template <int N> void streamShareN(size_t a, size_t b, size_t lo, uint8_t* buf, size_t perTree) const;
+    static constexpr size_t kStreamVertices = size_t(1) << 20;    // grid step
+    // Dispatch table entry: the instantiations for one n
+    struct Kernels {
+        void (ParallelTreeBuilder::*initData)();
+        void (ParallelTreeBuilder::*parents)(int, size_t, size_t, uint32_t*) const;
+        void (ParallelTreeBuilder::*parentsBlock)(size_t, size_t, uint32_t*, size_t) const;
+        void (ParallelTreeBuilder::*streamShare)(size_t, size_t, size_t, uint8_t*, size_t) const;
+    };
+    static constexpr int kMaxDim = 12;
+    template <int N> static constexpr Kernels kernelsFor();
+    static const Kernels& kernels(int n);
+    const Kernels* kernels_;                      // kernels(dim_)
+    // Index one tree's parent array as CSR children
+    void placeParents(int tree, const uint32_t* parents);
+    // Rank 0: post receives / place arrived chunks (block = wait for one)
+    void postChunkRecv(int slot);
+    bool pollChunks(bool block);
+    void placeChunk(const uint32_t* chunk);
+    // Rank 0 DOT output: every vertex key rendered once (keys_[v*n..]),
+    // then blocks of parents of all trees formatted by the OpenMP threads
+    // and written with one pwrite each at their fixed-width file offset
+    static constexpr size_t kDotBlockVertices = size_t(1) << 15;
+    ArenaVector<char> keys_;
+    void renderKeys();
+    // Trees firstTree..lastTree; pwrite directly, or queue on writer. False
+    // when a file failed to open or a direct write failed; queued writes
+    // report through writer->ok()
+    bool writeDots(int firstTree, int lastTree, AsyncWriter* writer) const;
+    static size_t formatKeyEdge(char* out, const char* p, const char* c, int n);
+    std::string dotPath(int tree) const;
+    std::string dotHeader(int tree) const;
+    // Fixed-width edge line '    "<p>" -> "<c>";\n'; returns its length
+    static size_t formatEdge(char* out, const uint8_t* p, const uint8_t* c, int n);
+    static size_t edgeLineLength(int n) { return 14 + 2 * size_t(n); }
+    // Collective output: ship edges to the owner of the parent, then every
+    // rank writes its parents' lines at their final file offset
+    int ownerOf(size_t v, int worldSize) const;
+    // Both collective writers return false on every rank if any rank failed
+    bool writeDotCollective(int tree, int rank, int worldSize);
+    // Collective .ist: rank 0 writes the header, every rank its parent slice
+    bool writeIstCollective(int tree, int rank, int worldSize);
+    // MPI_File_open on every rank; false everywhere (and nothing left
+    // open) unless it succeeded on all of them
+    static bool openAll(const std::string& path, MPI_File& fh);
+    // MPI_File_write_at_all for any size (collective over MPI_COMM_WORLD);
+    // false when a piece failed or wrote short on this rank
+    static bool writeAtAll(MPI_File fh, MPI_Offset offset, const char* data, size_t bytes);
+    // true on every rank iff ok on all of them (collective)
+    static bool allRanks(bool ok);
 };
 
 #endif // TREE_BUILDER_HPP
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "verifier.hpp"
+#include "permutation_utils.hpp"
+#include "ist_format.hpp"
+#include <algorithm>
+#include <omp.h>
+
+namespace {
+
+// Vertex -> tree marks of the paths of one vertex. Open addressing with a
+// generation stamp per slot, so clearing between vertices is O(1); a
+// vertex's paths usually fit the initial table, long ones grow it.
+class PathMarks {
+public:
+    PathMarks() { resize(10); }
+
+    void clear() {
+        size_ = 0;
+        if (++gen_ == 0) resize(bits_);   // stamps wrapped: wipe them
+    }
+
+    // Mark u as on the path of tree; returns -1, or the tree that got there first
+    int mark(uint32_t u, int tree) {
+        if (2 * (size_ + 1) > slots_.size()) grow();
+        size_t i = slotOf(u);
+        while (slots_[i].gen == gen_) {
+            if (slots_[i].vertex == u) return slots_[i].tree;
+            i = (i + 1) & mask_;
+        }
+        slots_[i] = {u, gen_, tree};
+        ++size_;
+        return -1;
+    }
+
+private:
+    struct Slot {
+        uint32_t vertex, gen;
+        int tree;
+    };
+    std::vector<Slot> slots_;
+    size_t mask_ = 0, size_ = 0;
+    int bits_ = 0;
+    uint32_t gen_ = 1;
+
+    size_t slotOf(uint32_t u) const { return (u * 2654435761u) >> (32 - bits_); }
+    void resize(int bits) {
+        bits_ = bits;
+        slots_.assign(size_t(1) << bits, Slot{0, 0, -1});
+        mask_ = slots_.size() - 1;
+        gen_ = 1;
+    }
+    void grow() {
+        std::vector<Slot> live;
+        for (const Slot& s : slots_)
+            if (s.gen == gen_) live.push_back(s);
+        resize(bits_ + 1);
+        size_ = 0;
+        for (const Slot& s : live) mark(s.vertex, s.tree);
+    }
+};
+
+} // namespace
+
+void TreeVerifier::Report::fail(uint64_t v, int tree, Failure kind) {
+    if (kind == kBadParent) ++badParents;
+    else if (kind == kCycle) cyclicTrees |= 1u << (tree - 1);
+    else ++sharedPaths;
+    firstFailure = std::min(firstFailure, v << 8 | uint64_t(tree) << 4 | kind);
+}
+
+void TreeVerifier::Report::merge(const Report& o) {
+    vertices += o.vertices;
+    badParents += o.badParents;
+    cyclicTrees |= o.cyclicTrees;
+    sharedPaths += o.sharedPaths;
+    steps += o.steps;
+    maxDepth = std::max(maxDepth, o.maxDepth);
+    firstFailure = std::min(firstFailure, o.firstFailure);
+}
+
+TreeVerifier::TreeVerifier(int n, std::vector<const uint32_t*> parents, uint32_t noParent)
+    : n_(n)
+    , count_(PermutationUtils::factorial(n))
+    , parents_(std::move(parents))
+    , noParent_(noParent)
+{}
+
+TreeVerifier::Report TreeVerifier::run(uint64_t first, uint64_t last) const {
+    const int T = int(parents_.size());
+    const uint32_t* const* par = parents_.data();
+    Report total;
+    const uint64_t blocks = (last - first + kBlock - 1) / kBlock;
+    #pragma omp parallel
+    {
+        Report r;
+        PathMarks marks;
+        uint8_t perm[32];
+        uint32_t cur[kMaxTrees];
+        int walk[kMaxTrees];
+
+        #pragma omp for schedule(dynamic)
+        for (uint64_t b = 0; b < blocks; ++b) {
+            uint64_t lo = first + b * kBlock, hi = std::min(last, lo + kBlock);
+            PermutationUtils::unrank(lo, n_, perm);
+            for (uint64_t v = lo; v < hi; std::next_permutation(perm, perm + n_), ++v) {
+                ++r.vertices;
+                if (v == 0) {
+                    for (int t = 0; t < T; ++t)
+                        if (par[t][0] != noParent_) r.fail(0, t + 1, kBadParent);
+                    continue;
+                }
+
+                // First edge of every tree must be an edge of B_n
+                marks.clear();
+                marks.mark(uint32_t(v), T);        // v itself is on every path
+                int live = 0;
+                bool shared = false;
+                for (int t = 0; t < T; ++t) {
+                    uint32_t p = par[t][v];
+                    if (p == noParent_ || p >= count_ || p == v ||
+                        p != PermutationUtils::rankAfterSwap(perm, n_, v, SwapCode::encode(v, p, n_))) {
+                        r.fail(v, t + 1, kBadParent);
+                        continue;
+                    }
+                    if (p == 0) {
+                        r.maxDepth = std::max<uint64_t>(r.maxDepth, 1);
+                    } else {
+                        cur[live] = p;
+                        walk[live++] = t;
+                    }
+                }
+
+                // The remaining paths, one link per tree per round
+                for (uint64_t depth = 1; live > 0 && !shared; ++depth) {
+                    for (int i = 0; i < live && !shared; ) {
+                        int t = walk[i], owner = marks.mark(cur[i], t);
+                        bool done = true;
+                        if (owner == t || owner == T) {
+                            r.fail(v, t + 1, kCycle);
+                        } else if (owner >= 0) {
+                            r.fail(v, t + 1, kSharedPath);
+                            shared = true;
+                        } else {
+                            uint32_t q = par[t][cur[i]];
+                            ++r.steps;
+                            if (q == 0) r.maxDepth = std::max(r.maxDepth, depth + 1);
+                            // q == noParent_ or out of range: reported at cur[i]
+                            else if (q != noParent_ && q < count_) { cur[i] = q; done = false; }
+                        }
+                        if (done) { --live; cur[i] = cur[live]; walk[i] = walk[live]; }
+                        else ++i;
+                    }
+                }
+            }
+        }
+        #pragma omp critical
+        total.merge(r);
+    }
+    return total;
+}
@@ -0,0 +1,61 @@
+#ifndef VERIFIER_HPP
+#define VERIFIER_HPP
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Checks the contract of a set of trees on B_n given as parent arrays
+// (vertex v = lexicographic rank, root = 0, the identity):
+//
+//  - spanning: the root has no parent in any tree, every other vertex has
+//    one, and it is one adjacent swap away (an edge of B_n);
+//  - acyclic, so every vertex reaches the root;
+//  - independent: for every vertex v the root paths of all trees are
+//    internally vertex-disjoint (they share only v and the root).
+//
+// One pass over the vertices: the paths of a vertex are walked in
+// lockstep, one parent link per tree per step so the random loads of the
+// trees overlap, and every vertex on them is marked with its tree in a
+// small per-thread hash set. A vertex found marked by its own tree closes
+// a cycle and ends that walk; marked by another tree, two paths meet and
+// the vertex is done. Every tree is walked from every vertex, cyclic or
+// not, so a cyclic tree's path up to where it closes still takes part in
+// the independence check, and the report does not depend on how the
+// vertices are split among threads and ranks.
+class TreeVerifier {
+public:
+    static constexpr int kMaxTrees = 15;
+    // parents[t][v] = parent of v in tree t+1, noParent for the root;
+    // every array covers all n! vertices
+    TreeVerifier(int n, std::vector<const uint32_t*> parents, uint32_t noParent);
+
+    enum Failure : uint8_t { kBadParent = 1, kCycle = 2, kSharedPath = 3 };
+    struct Report {
+        uint64_t vertices = 0;
+        uint64_t badParents = 0;     // (vertex, tree) with a wrong parent
+        uint32_t cyclicTrees = 0;    // bit t-1: a walk in tree t came back onto its path
+        uint64_t sharedPaths = 0;    // vertices whose paths meet before the root
+        uint64_t steps = 0;          // parent links followed
+        uint64_t maxDepth = 0;       // longest root path, in edges
+        // Smallest (vertex << 8 | tree << 4 | Failure), or kNone
+        static constexpr uint64_t kNone = UINT64_MAX;
+        uint64_t firstFailure = kNone;
+
+        bool ok() const { return badParents == 0 && cyclicTrees == 0 && sharedPaths == 0; }
+        void fail(uint64_t v, int tree, Failure kind);
+        void merge(const Report& o);
+    };
+
+    // Vertices [first, last); OpenMP threads take blocks of kBlock
+    Report run(uint64_t first, uint64_t last) const;
+
+private:
+    static constexpr uint64_t kBlock = 4096;
+    int n_;
+    uint64_t count_;
+    std::vector<const uint32_t*> parents_;
+    uint32_t noParent_;
+};
+
+#endif // VERIFIER_HPP
@@ -0,0 +1,110 @@
+#include "vertex_order.hpp"
+#include "permutation_utils.hpp"
+#include <omp.h>
+#include <cmath>
+#include <algorithm>
+
+namespace {
+
+// Set-associative cache with true LRU: every set holds kSimWays line tags
+// ordered most recent first
+class CacheModel {
+public:
+    CacheModel()
+        : sets_(VertexOrder::kSimBytes / 64 / VertexOrder::kSimWays)
+        , tags_(sets_ * VertexOrder::kSimWays, UINT64_MAX) {}
+
+    // true on a miss
+    bool access(uint64_t addr) {
+        uint64_t line = addr >> 6;
+        uint64_t* set = tags_.data() + (line % sets_) * VertexOrder::kSimWays;
+        int w = 0;
+        while (w < VertexOrder::kSimWays - 1 && set[w] != line) ++w;
+        bool miss = set[w] != line;
+        std::copy_backward(set, set + w, set + w + 1);
+        set[0] = line;
+        return miss;
+    }
+
+private:
+    size_t sets_;
+    std::vector<uint64_t> tags_;
+};
+
+} // namespace
+
+VertexOrder::VertexOrder(int n, Kind kind) {
+    size_t count = PermutationUtils::factorial(n);
+    toOrder_.resize(count);
+    toLex_.resize(count);
+    #pragma omp parallel
+    {
+        // every thread walks its own lexicographic share from an unranked start
+        int tid = omp_get_thread_num(), nt = omp_get_num_threads();
+        size_t lo = count * tid / nt, hi = count * (tid + 1) / nt;
+        uint8_t perm[32];
+        if (lo < hi) PermutationUtils::unrank(lo, n, perm);
+        for (size_t v = lo; v < hi; ++v) {
+            uint32_t i = kind == Kind::Sjt ? uint32_t(PermutationUtils::sjtRank(perm, n)) : uint32_t(v);
+            toOrder_[v] = i;
+            toLex_[i] = uint32_t(v);
+            std::next_permutation(perm, perm + n);
+        }
+    }
+}
+
+const char* VertexOrder::name(Kind kind) {
+    return kind == Kind::Sjt ? "SJT" : "lexicographic";
+}
+
+void VertexOrder::relabel(const uint32_t* parent, uint32_t* out, uint32_t noParent) const {
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < size(); ++i) {
+        uint32_t p = parent[toLex_[i]];
+        out[i] = p == noParent ? noParent : toOrder_[p];
+    }
+}
+
+VertexOrder::Locality VertexOrder::locality(const uint32_t* parent, uint32_t noParent) const {
+    double logSum = 0;
+    size_t line = 0, page = 0, edges = 0;
+    #pragma omp parallel for schedule(static) reduction(+:logSum, line, page, edges)
+    for (size_t v = 0; v < size(); ++v) {
+        if (parent[v] == noParent) continue;
+        uint32_t a = toOrder_[v], b = toOrder_[parent[v]];
+        logSum += std::log2(double(a > b ? a - b : b - a));
+        line += (a >> 4) == (b >> 4);
+        page += (a >> 10) == (b >> 10);
+        ++edges;
+    }
+    double e = edges ? double(edges) : 1.0;
+    return Locality{logSum / e, line / e, page / e};
+}
+
+double VertexOrder::indexBuildMisses(const uint32_t* parent, size_t count, uint32_t noParent) {
+    // Array bases far apart on 2 MiB boundaries, like arena tables
+    const uint64_t parentBase = 0, offsetsBase = uint64_t(1) << 36, childrenBase = uint64_t(2) << 36;
+    std::vector<uint32_t> end(count + 1, 0);
+    CacheModel cache;
+    uint64_t misses = 0;
+    // histogram: offsets[p]++
+    for (size_t v = 0; v < count; ++v) {
+        misses += cache.access(parentBase + 4 * v);
+        uint32_t p = parent[v];
+        if (p == noParent) continue;
+        misses += cache.access(offsetsBase + 4 * uint64_t(p));
+        ++end[p];
+    }
+    // the prefix sum streams offsets once
+    for (size_t p = 0; p < count; p += 16) misses += cache.access(offsetsBase + 4 * p);
+    for (size_t p = 1; p < count; ++p) end[p] += end[p-1];
+    // scatter: children[--offsets[p]] = v
+    for (size_t v = 0; v < count; ++v) {
+        misses += cache.access(parentBase + 4 * v);
+        uint32_t p = parent[v];
+        if (p == noParent) continue;
+        misses += cache.access(offsetsBase + 4 * uint64_t(p));
+        misses += cache.access(childrenBase + 4 * uint64_t(--end[p]));
+    }
+    return count ? double(misses) / double(count) : 0.0;
+}
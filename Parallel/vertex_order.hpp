@@ -0,0 +1,50 @@
+#ifndef VERTEX_ORDER_HPP
+#define VERTEX_ORDER_HPP
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// A numbering of the n! vertices and its translation to and from the
+// lexicographic ranks everything else uses (tables, trees, files, keys).
+// A lexicographic parent array is moved into the order with relabel();
+// the arrays it came from stay lexicographic, and so does every file.
+// Only the --locality measurement uses it: measured at n = 10, the SJT
+// numbering does not repay its translation in the build, so no build
+// path runs in it.
+class VertexOrder {
+public:
+    enum class Kind { Lex, Sjt };
+
+    // Both translation tables, 8 bytes per vertex (OpenMP)
+    VertexOrder(int n, Kind kind);
+    static const char* name(Kind kind);
+
+    size_t size() const { return toOrder_.size(); }
+
+    // out[i] = number of the parent of the vertex numbered i; noParent
+    // entries stay noParent
+    void relabel(const uint32_t* parent, uint32_t* out, uint32_t noParent) const;
+
+    // How far apart a vertex and its parent are in this numbering
+    struct Locality {
+        double meanLog2Distance;    // mean log2 of |index(v) - index(parent)|
+        double sameLine;            // share in one 64-byte line of a uint32 array
+        double samePage;            // share in one 4 KiB page of a uint32 array
+    };
+    Locality locality(const uint32_t* parent, uint32_t noParent) const;
+
+    // Cache misses per vertex of the histogram and scatter passes of
+    // ChildIndex::build over parent (already in the numbering it is to be
+    // measured in), replayed one thread through a simulated LRU cache of
+    // kSimBytes, kSimWays-way, 64-byte lines; parent, offsets and children
+    // are separate 2 MiB aligned arrays. A stand-in for hardware counters.
+    static constexpr size_t kSimBytes = size_t(1) << 20;
+    static constexpr int kSimWays = 16;
+    static double indexBuildMisses(const uint32_t* parent, size_t count, uint32_t noParent);
+
+private:
+    std::vector<uint32_t> toOrder_, toLex_;
+};
+
+#endif // VERTEX_ORDER_HPP
@@ -0,0 +1,49 @@
+#include "arena.hpp"
+#include <algorithm>
+#include <new>
+#include <sys/mman.h>
+
+Arena::~Arena() {
+    for (const Chunk& c : chunks_) munmap(c.base, c.size);
+}
+
+void Arena::grow(size_t bytes) {
+    size_t size = std::max(kChunk, (bytes + kHugePage - 1) / kHugePage * kHugePage);
+    const int prot = PROT_READ | PROT_WRITE, flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+#ifdef MAP_HUGETLB
+    if (explicitHuge_) {
+        void* p = mmap(nullptr, size, prot, flags | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            chunks_.push_back({static_cast<uint8_t*>(p), size, 0, true});
+            return;
+        }
+    }
+#endif
+
+    // Over-map by one huge page and trim both ends to a 2 MiB boundary, so
+    // every 2 MiB of the chunk can be a transparent huge page
+    void* p = mmap(nullptr, size + kHugePage, prot, flags, -1, 0);
+    if (p == MAP_FAILED) throw std::bad_alloc();
+    uintptr_t raw = reinterpret_cast<uintptr_t>(p);
+    uintptr_t base = (raw + kHugePage - 1) & ~(kHugePage - 1);
+    size_t head = base - raw, tail = kHugePage - head;
+    if (head) munmap(p, head);
+    if (tail) munmap(reinterpret_cast<void*>(base + size), tail);
+#ifdef MADV_HUGEPAGE
+    madvise(reinterpret_cast<void*>(base), size, MADV_HUGEPAGE);
+#endif
+    chunks_.push_back({reinterpret_cast<uint8_t*>(base), size, 0, false});
+}
+
+size_t Arena::mappedBytes() const {
+    size_t sum = 0;
+    for (const Chunk& c : chunks_) sum += c.size;
+    return sum;
+}
+
+size_t Arena::hugetlbBytes() const {
+    size_t sum = 0;
+    for (const Chunk& c : chunks_) sum += c.hugetlb ? c.size : 0;
+    return sum;
+}
@@ -0,0 +1,127 @@
+#include "checkpoint.hpp"
+#include "ist_format.hpp"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+uint64_t Checkpoint::Layout::last(uint64_t b) const {
+    uint64_t hi = first(b) + blockVertices;
+    return hi < count ? hi : count;
+}
+
+uint64_t Checkpoint::Layout::offset(uint64_t b) const {
+    return sizeof(IstHeader) + (swapCodes ? first(b) / 2 : 4 * first(b));
+}
+
+uint64_t Checkpoint::Layout::bytes(uint64_t b) const {
+    uint64_t len = last(b) - first(b);
+    return swapCodes ? len / 2 : 4 * len;
+}
+
+uint64_t Checkpoint::checksum(const void* data, size_t bytes) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < bytes; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+std::string Checkpoint::signature(const Layout& layout) {
+    // First journal line; journals from another n or format are ignored
+    return "ist-manifest n=" + std::to_string(layout.n) + " codes=" + std::to_string(int(layout.swapCodes)) +
+           " block=" + std::to_string(layout.blockVertices);
+}
+
+static bool isJournal(const fs::path& p) {
+    return p.filename().string().rfind("manifest.", 0) == 0;
+}
+
+void Checkpoint::clear(const std::string& dir) {
+    if (!fs::exists(dir)) return;
+    for (const auto& entry : fs::directory_iterator(dir))
+        if (isJournal(entry.path())) fs::remove(entry.path());
+}
+
+std::vector<uint8_t> Checkpoint::completedBlocks(const std::string& dir, const Layout& layout) {
+    uint64_t B = layout.blocks();
+    std::vector<uint8_t> done(B, 0);
+    if (!fs::exists(dir)) return done;
+
+    // (tree, block) -> recorded checksum; later lines win
+    std::map<std::pair<int, uint64_t>, uint64_t> recorded;
+    std::string sig = signature(layout);
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        if (!isJournal(entry.path())) continue;
+        std::ifstream in(entry.path());
+        std::string line;
+        if (!std::getline(in, line) || line != sig) {
+            std::cerr << "Ignoring journal " << entry.path() << " (other run layout)" << std::endl;
+            continue;
+        }
+        // a torn last line from a crash fails to parse and is dropped
+        while (std::getline(in, line)) {
+            std::istringstream ss(line);
+            int t;
+            uint64_t b, sum;
+            if (ss >> t >> b >> sum && t >= 1 && t <= layout.trees && b < B)
+                recorded[{t, b}] = sum;
+        }
+    }
+
+    // A block counts only if every tree has it and the bytes still match
+    std::vector<int> hits(B, 0);
+    std::vector<char> buf;
+    for (int t = 1; t <= layout.trees; ++t) {
+        std::string path = IstWriter::path(layout.n, t);
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) continue;
+        for (auto it = recorded.lower_bound({t, 0}); it != recorded.end() && it->first.first == t; ++it) {
+            uint64_t b = it->first.second;
+            buf.resize(layout.bytes(b));
+            if (pread(fd, buf.data(), buf.size(), off_t(layout.offset(b))) == ssize_t(buf.size()) &&
+                checksum(buf.data(), buf.size()) == it->second)
+                ++hits[b];
+        }
+        close(fd);
+    }
+    for (uint64_t b = 0; b < B; ++b)
+        done[b] = (hits[b] == layout.trees);
+    return done;
+}
+
+Checkpoint::Checkpoint(const std::string& dir, int id, const Layout& layout) {
+    fs::create_directories(dir);
+    std::string path = dir + "/manifest." + std::to_string(id);
+    bool fresh = !fs::exists(path) || fs::file_size(path) == 0;
+    if (!fresh) {
+        // an existing journal from another layout would be ignored whole
+        std::ifstream in(path);
+        std::string line;
+        if (!std::getline(in, line) || line != signature(layout)) fresh = true;
+    }
+    journal_ = std::fopen(path.c_str(), fresh ? "w" : "a");
+    if (!journal_) {
+        std::cerr << "Failed to open journal: " << path << std::endl;
+        return;
+    }
+    if (fresh) std::fprintf(journal_, "%s\n", signature(layout).c_str());
+    std::fflush(journal_);
+}
+
+Checkpoint::~Checkpoint() {
+    if (journal_) std::fclose(journal_);
+}
+
+void Checkpoint::record(int tree, uint64_t block, uint64_t sum) {
+    if (!journal_) return;
+    std::fprintf(journal_, "%d %llu %llu\n", tree, (unsigned long long)block, (unsigned long long)sum);
+    std::fflush(journal_);
+}
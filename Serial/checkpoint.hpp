@@ -0,0 +1,51 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+
+// Restartable streaming output. The n! vertices are cut into a fixed grid
+// of blocks that does not depend on the number of ranks; once a block of a
+// tree is on disk, a line "tree block checksum" is appended to a journal
+// ist/<n>/manifest.<id>. A restarted run reads every journal in the
+// directory, re-checks each recorded block against the .ist file and only
+// computes the blocks that are missing or damaged.
+class Checkpoint {
+public:
+    struct Layout {
+        int n, trees;
+        uint64_t count;             // n!
+        uint64_t blockVertices;     // grid step, even
+        bool swapCodes;             // .ist section: codes or uint32 parents
+
+        uint64_t blocks() const { return (count + blockVertices - 1) / blockVertices; }
+        uint64_t first(uint64_t b) const { return b * blockVertices; }
+        uint64_t last(uint64_t b) const;
+        // Position and size of block b inside a tree file
+        uint64_t offset(uint64_t b) const;
+        uint64_t bytes(uint64_t b) const;
+    };
+
+    // FNV-1a, 64-bit
+    static uint64_t checksum(const void* data, size_t bytes);
+
+    // done[b] = 1 when every tree's block b is recorded and still matches
+    static std::vector<uint8_t> completedBlocks(const std::string& dir, const Layout& layout);
+    // Delete all journals in dir (fresh run)
+    static void clear(const std::string& dir);
+
+    // Append to dir/manifest.<id>; records must follow the block's write
+    Checkpoint(const std::string& dir, int id, const Layout& layout);
+    ~Checkpoint();
+    Checkpoint(const Checkpoint&) = delete;
+    Checkpoint& operator=(const Checkpoint&) = delete;
+    void record(int tree, uint64_t block, uint64_t sum);
+
+private:
+    std::FILE* journal_ = nullptr;
+    static std::string signature(const Layout& layout);
+};
+
+#endif // CHECKPOINT_HPP
@@ -0,0 +1,18 @@
+#include "child_index.hpp"
+
+void ChildIndex::build(const uint32_t* parent, size_t count, uint32_t noParent) {
+    // histogram: offsets[p+1] = number of children of p
+    offsets.assign(count + 1, 0);
+    for (size_t v = 0; v < count; ++v)
+        if (parent[v] != noParent) offsets[parent[v] + 1]++;
+
+    // exclusive prefix sum: offsets[p] = start of p's range
+    for (size_t p = 0; p < count; ++p)
+        offsets[p + 1] += offsets[p];
+    children.resize(offsets[count]);
+
+    // scatter in ascending v so each range comes out sorted
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t v = 0; v < count; ++v)
+        if (parent[v] != noParent) children[cursor[parent[v]]++] = (uint32_t)v;
+}
@@ -1,35 +1,77 @@
-//g++ -O3 -std=c++17 main.cpp tree_builder.cpp permutation_utils.cpp -o serial_tree_builder
+//g++ -O3 -std=c++17 main.cpp tree_builder.cpp permutation_utils.cpp child_index.cpp ist_format.cpp async_writer.cpp checkpoint.cpp arena.cpp -pthread -o serial_tree_builder
 //./serial_tree_builder.exe 3  
 
 #include "tree_builder.hpp"
 #include <iostream>
 #include <chrono>
 #include <iomanip>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include <sys/resource.h>
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <n>\n";
+    bool binary = false, swapCodes = false, async = false, streaming = false, resume = false, hugetlb = false;
+    bool badArgs = (argc < 2);
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--ist") binary = true;
+        else if (arg == "--swap4") binary = swapCodes = true;
+        else if (arg == "--async") async = true;
+        else if (arg == "--stream") streaming = binary = true;
+        else if (arg == "--resume") streaming = binary = resume = true;
+        else if (arg == "--hugetlb") hugetlb = true;
+        else badArgs = true;
+    }
+    if (badArgs) {
+        std::cerr << "Usage: " << argv[0] << " <n> [--ist] [--swap4] [--async] [--stream] [--resume] [--hugetlb]\n"
+                  << "  --ist     write binary .ist trees to ist/<n>/ instead of DOT\n"
+                  << "  --swap4   .ist trees as 4-bit swap positions (implies --ist)\n"
+                  << "  --async   write DOT files from a background writer thread\n"
+                  << "  --stream  no tables, write .ist trees block by block (implies --ist, allows n <= 12)\n"
+                  << "  --resume  --stream, skipping blocks a previous run completed\n"
+                  << "  --hugetlb tables in explicit huge pages (MAP_HUGETLB) when the pool has room\n";
         return 1;
     }
 
+    int maxN = streaming ? 12 : 10;
     int n = std::stoi(argv[1]);
-    if (n < 2 || n > 10) {
-        std::cerr << "n must be 2..10\n";
+    if (n < 2 || n > maxN) {
+        std::cerr << "n must be 2.." << maxN << (streaming ? "\n" : " (2..12 with --stream)\n");
         return 1;
     }
 
     auto start_time = std::chrono::high_resolution_clock::now();
     
-    TreeBuilder builder(n);
+    auto builder = std::make_unique<TreeBuilder>(n, streaming, hugetlb);
     auto init_time = std::chrono::high_resolution_clock::now();
 
-    // Build all trees
-    auto trees = builder.buildTrees();
+    // Build all trees (streaming builds and writes together below)
+    if (!streaming) builder->buildTrees();
     auto tree_build_time = std::chrono::high_resolution_clock::now();
 
     // Export each tree
-    for (int t = 1; t < n; ++t) {
-        builder.writeGraph(t, builder.getChildren(t));
+    double ioBusy = 0, ioWaited = 0;
+    bool written = true;
+    if (streaming) {
+        // one buffer per tree for the block being filled, one for the block in flight
+        AsyncWriter writer(2 * size_t(n - 1));
+        written = builder->streamTrees(swapCodes, resume, writer);
+        writer.drain();
+        ioBusy = writer.busySeconds();
+        ioWaited = writer.waitSeconds();
+    } else if (binary) {
+        for (int t = 1; t < n; ++t)
+            written = builder->writeBinary(t, builder->getChildren(t), swapCodes) && written;
+    } else if (async) {
+        AsyncWriter writer;
+        written = builder->writeGraphs(&writer);
+        writer.drain();
+        written = writer.ok() && written;
+        ioBusy = writer.busySeconds();
+        ioWaited = writer.waitSeconds();
+    } else {
+        written = builder->writeGraphs();
     }
     auto write_time = std::chrono::high_resolution_clock::now();
 
@@ -47,9 +89,28 @@ int main(int argc, char* argv[]) {
     std::cout << "Writing time: " 
               << std::chrono::duration<double>(write_time - tree_build_time).count() 
               << " seconds\n";
+    if ((async && !binary) || streaming) {
+        std::cout << "Writer thread busy: " << ioBusy << " seconds, waited for writer: " << ioWaited
+                  << " seconds, I/O hidden: " << std::max(0.0, ioBusy - ioWaited) << " seconds\n";
+    }
     std::cout << "Total execution time: " 
               << std::chrono::duration<double>(end_time - start_time).count() 
               << " seconds\n";
 
+    // Freeing the tables, then the page faults of the whole run
+    auto teardown_start = std::chrono::high_resolution_clock::now();
+    builder.reset();
+    auto teardown_end = std::chrono::high_resolution_clock::now();
+    std::cout << "Teardown time: "
+              << std::chrono::duration<double>(teardown_end - teardown_start).count()
+              << " seconds\n";
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    std::cout << "Page faults: " << (usage.ru_minflt + usage.ru_majflt) << "\n";
+
+    if (!written) {
+        std::cerr << "Output is incomplete\n";
+        return 1;
+    }
     return 0;
 }
@@ -3,16 +3,109 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <new>
+#include <cstddef>
 #include <cstdint>
 
+// Cache-line aligned, uninitialized byte buffer
+constexpr size_t kCacheLine = 64;
+struct AlignedDelete {
+    void operator()(uint8_t* p) const { ::operator delete[](p, std::align_val_t(kCacheLine)); }
+};
+using AlignedBuffer = std::unique_ptr<uint8_t[], AlignedDelete>;
+AlignedBuffer allocateAligned(size_t bytes);
+
+// Flat table of fixed-width byte rows (one permutation or lookup row per
+// vertex). Rows are padded to a power-of-two stride and the block is
+// cache-line aligned, so no row straddles a cache line.
+class PermTable {
+public:
+    static constexpr size_t kAlign = kCacheLine;
+
+    PermTable() = default;
+    PermTable(size_t rows, int width) { resize(rows, width); }
+
+    // (Re)allocate rows x width; contents are left uninitialized
+    void resize(size_t rows, int width);
+    // View rows x width stored in memory owned elsewhere (at least
+    // bytesFor(rows, width) bytes, kAlign-aligned)
+    void attach(uint8_t* data, size_t rows, int width);
+
+    static size_t strideFor(int width);
+    static size_t bytesFor(size_t rows, int width) { return rows * strideFor(width); }
+
+    uint8_t* row(size_t i) { return data_ + i * stride_; }
+    const uint8_t* row(size_t i) const { return data_ + i * stride_; }
+
+    size_t rows() const { return rows_; }
+    int width() const { return width_; }
+    size_t stride() const { return stride_; }
+    size_t bytes() const { return rows_ * stride_; }
+
+private:
+    AlignedBuffer storage_;
+    uint8_t* data_ = nullptr;
+    size_t rows_ = 0;
+    size_t stride_ = 0;
+    int width_ = 0;
+};
+
 // Utility for generating and keying permutations
 class PermutationUtils {
 public:
-    // Generate all permutations of {1..n}
-    static std::vector<std::vector<int>> allPerms(int n);
+    // Fill out with all permutations of {1..n} in lexicographic order
+    static void allPerms(int n, PermTable& out);
+
+    // Fill out with the permutations ranked [first, first+count)
+    static void permRange(int n, uint64_t first, uint64_t count, PermTable& out);
+    // Same, into an already sized (or attached) table of out.rows() rows;
+    // with OpenMP every thread unranks the start of its share of the rows
+    static void fillRange(int n, uint64_t first, PermTable& out);
+    // Rows [rows*part/parts, rows*(part+1)/parts) of fillRange
+    static void fillShare(int n, uint64_t first, PermTable& out, int part, int parts);
+
+    // Convert a permutation row to a string key
+    static std::string toKey(const uint8_t* perm, int n);
+    // Key character of symbol v: '1'..'9', then 'A' for 10, 'B' for 11, ...
+    static char symbolChar(int v) { return char(v < 10 ? '0' + v : 'A' + v - 10); }
+
+    // n! (exact for n <= 20)
+    static uint64_t factorial(int n);
+    static constexpr uint64_t kFactorial[21] = {
+        1ull, 1ull, 2ull, 6ull, 24ull, 120ull, 720ull, 5040ull, 40320ull,
+        362880ull, 3628800ull, 39916800ull, 479001600ull, 6227020800ull,
+        87178291200ull, 1307674368000ull, 20922789888000ull,
+        355687428096000ull, 6402373705728000ull, 121645100408832000ull,
+        2432902008176640000ull };
+
+    // Lexicographic index of a permutation of {1..n} via its Lehmer code;
+    // matches the order produced by allPerms / std::next_permutation
+    static uint64_t rank(const uint8_t* perm, int n);
+
+    // Inverse of rank: write the idx-th permutation of {1..n} into out
+    static void unrank(uint64_t idx, int n, uint8_t* out);
+
+    // Rank change caused by exchanging the symbols a (at pos) and b (at
+    // pos+1), where between counts the symbols strictly between a and b
+    // located after pos+1. Only the Lehmer digits at pos and pos+1 move.
+    static int64_t swapRankDelta(int a, int b, int between, int pos, int n) {
+        int64_t d = int64_t(between + 1) * kFactorial[n-1-pos]
+                  - int64_t(between) * kFactorial[n-2-pos];
+        return a < b ? d : -d;
+    }
 
-    // Convert a permutation vector to a string key
-    static std::string toKey(const std::vector<int>& perm);
+    // Rank of perm with positions pos and pos+1 exchanged, given the rank
+    // of perm itself. O(n), no allocation.
+    static uint64_t rankAfterSwap(const uint8_t* perm, int n, uint64_t rank, int pos) {
+        if (pos + 1 >= n) return rank;
+        int a = perm[pos], b = perm[pos+1];
+        int lo = a < b ? a : b, hi = a < b ? b : a;
+        int between = 0;
+        for (int j = pos + 2; j < n; ++j)
+            between += (perm[j] > lo && perm[j] < hi);
+        return rank + swapRankDelta(a, b, between, pos, n);
+    }
 };
 
 #endif // PERMUTATION_UTILS_HPP
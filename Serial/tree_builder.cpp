@@ -1,78 +1,124 @@
 // File: tree_builder.cpp
 #include "tree_builder.hpp"
 #include "permutation_utils.hpp"
+#include "ist_format.hpp"
+#include "async_writer.hpp"
+#include "checkpoint.hpp"
 #include <numeric>
 #include <fstream>
 #include <iostream>
 #include <filesystem>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 //tree
-TreeBuilder::TreeBuilder(int n)
+TreeBuilder::TreeBuilder(int n, bool streaming, bool explicitHugePages)
   : n_(n)
   , T_(n - 1)
+  , arena_(explicitHugePages)
+  , firstMismatch_(ArenaAllocator<int>(&arena_))
   , identity_(n)
+  , keys_(ArenaAllocator<char>(&arena_))
 {
     std::cout << "TreeBuilder constructor: n=" << n << std::endl;
     std::iota(identity_.begin(), identity_.end(), 1);
     std::cout << "Identity permutation: ";
-    for (int x : identity_) std::cout << x << " ";
+    for (uint8_t x : identity_) std::cout << (int)x << " ";
     std::cout << std::endl;
 
+    // Streaming fills the tables one block at a time in streamTrees
+    if (streaming) {
+        total_ = PermutationUtils::factorial(n);
+        std::cout << "Total permutations: " << total_ << " (streamed)" << std::endl;
+        return;
+    }
+
     // Generate permutations
-    perms_ = PermutationUtils::allPerms(n);
-    total_ = perms_.size();
+    total_ = PermutationUtils::factorial(n);
+    perms_.attach(arena_.allocate<uint8_t>(PermTable::bytesFor(total_, n)), total_, n);
+    PermutationUtils::fillRange(n, 0, perms_);
     std::cout << "Total permutations: " << total_ << std::endl;
 
     // Initialize tables
-    posIndex_.resize(total_, std::vector<int>(n+1));
+    posIndex_.attach(arena_.allocate<uint8_t>(PermTable::bytesFor(total_, n+1)), total_, n+1);
     firstMismatch_.resize(total_);
     initTables();
 }
 
 void TreeBuilder::initTables() {
-    for (size_t i = 0; i < total_; ++i) {
-        auto &p = perms_[i];
-        indexOf_[PermutationUtils::toKey(p)] = i;
+    for (size_t i = 0; i < perms_.rows(); ++i) {
+        const uint8_t* p = perms_.row(i);
+        uint8_t* pos = posIndex_.row(i);
         for (int j = 0; j < n_; ++j)
-            posIndex_[i][p[j]] = j;
+            pos[p[j]] = uint8_t(j);
         int r = n_-1;
         while (r >= 0 && p[r] == r+1) --r;
         firstMismatch_[i] = (r < 0 ? 1 : r);
     }
 }
 
-std::vector<int> TreeBuilder::swapAdjacent(size_t idx, int sym) const {
-    auto v = perms_[idx];
-    int pos = posIndex_[idx][sym];
-    if (pos < 0 || pos+1 >= (int)v.size()) return v;
-    std::swap(v[pos], v[pos+1]);
-    return v;
+void TreeBuilder::swapPositions(int t, size_t first, size_t count, uint8_t* out) const {
+    // Every rule is evaluated for every vertex and the answer picked with
+    // selects, so the loop body has no data-dependent branches
+    const int n = n_;
+    for (size_t k = 0; k < count; ++k) {
+        size_t v = first + k;
+        const uint8_t* p = perms_.row(v - base_);
+        const uint8_t* pos = posIndex_.row(v - base_);
+        int last = p[n-1], prev = p[n-2];
+        int posN = pos[n], posT = pos[t], posT1 = pos[t > 1 ? t-1 : 1];
+        // swapping q, q+1 reaches the root only from the vertex of rank (n-1-q)!
+        bool rootT = posT < n-1 && v == PermutationUtils::kFactorial[n-1-posT];
+        bool rootN = posN < n-1 && v == PermutationUtils::kFactorial[n-1-posN];
+
+        // last == n: tree n-1 swaps with prev, the others fall back
+        int fallback = (prev == t || prev == n-1) ? pos[firstMismatch_[v - base_] + 1] : posT;
+        fallback = (t == 2 && rootT) ? pos[1] : fallback;
+        int ruleN = (t == n-1) ? pos[prev] : fallback;
+        // n-1 then n: move n forward unless that reaches the root
+        bool pairN = last == n-1 && prev == n && !rootN;
+        int rulePair = (t == 1) ? posN : posT1;
+        int ruleLast = (last == t) ? posN : posT;
+        out[k] = uint8_t(last == n ? ruleN : (pairN ? rulePair : ruleLast));
+    }
 }
 
-std::vector<int> TreeBuilder::fallback(size_t idx, int t) const {
-    auto v = swapAdjacent(idx, t);
-    if (t == 2 && v == identity_) return swapAdjacent(idx, 1);
-    int pen = perms_[idx][n_-2];
-    if (pen == t || pen == n_-1) return swapAdjacent(idx, firstMismatch_[idx] + 1);
-    return v;
+void TreeBuilder::parents(int t, size_t first, size_t count, uint32_t* out) const {
+    uint8_t q[kBatch];
+    for (size_t k = 0; k < count; k += kBatch) {
+        size_t len = std::min(kBatch, count - k);
+        swapPositions(t, first + k, len, q);
+        for (size_t j = 0; j < len; ++j)
+            out[k + j] = uint32_t(swappedRank(first + k + j, q[j]));
+    }
+    if (first == 0 && count > 0) out[0] = kIstNoParent;  // row 0 is the identity (root)
 }
 
-size_t TreeBuilder::findParent(size_t idx, int t) const {
-    const auto &p = perms_[idx];
-    int last = p[n_-1], prev = p[n_-2];
-    if (last == n_) {
-        if (t != n_-1)
-            return indexOf_.at(PermutationUtils::toKey(fallback(idx,t)));
-        return indexOf_.at(PermutationUtils::toKey(swapAdjacent(idx, prev)));
+bool TreeBuilder::writeGraphs(AsyncWriter* writer) {
+    // Every key rendered once; edge lines then copy fixed-width keys
+    keys_.resize(total_ * n_);
+    for (size_t v = 0; v < total_; ++v) {
+        const uint8_t* row = perms_.row(v);
+        for (int i = 0; i < n_; ++i) keys_[v * n_ + i] = PermutationUtils::symbolChar(row[i]);
     }
-    if (last == n_-1 && prev == n_ && swapAdjacent(idx, n_) != identity_) {
-        auto alt = (t == 1 ? swapAdjacent(idx, n_) : swapAdjacent(idx, t-1));
-        return indexOf_.at(PermutationUtils::toKey(alt));
+    bool ok = true;
+    for (int t = 1; t <= T_; ++t)
+        ok = writeGraph(t, getChildren(t), writer) && ok;
+    return ok;
+}
+
+static bool writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t w = ::write(fd, data, len);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        data += w; len -= size_t(w);
     }
-    auto swp = (last == t ? swapAdjacent(idx, n_) : swapAdjacent(idx, t));
-    return indexOf_.at(PermutationUtils::toKey(swp));
+    return true;
 }
 
-void TreeBuilder::writeGraph(int treeId, const std::vector<std::vector<uint32_t>>& children) const {
+bool TreeBuilder::writeGraph(int treeId, const ChildIndex& children, AsyncWriter* writer) const {
     // Create dot directory and subdirectory for this n
     std::string dotDir = "dot/" + std::to_string(n_);
     std::filesystem::create_directories(dotDir);
@@ -80,81 +126,187 @@ void TreeBuilder::writeGraph(int treeId, const std::vector<std::vector<uint32_t>
     std::string fn = dotDir + "/Tree_" + std::to_string(n_) + "_" + std::to_string(treeId) + ".dot";
     std::cout << "Writing graph to " << fn << "...\n";
     
-    // Try to open file in binary mode to ensure proper writing
-    std::ofstream out(fn, std::ios::binary);
-    if (!out.is_open()) {
+    int fd = open(fn.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
         std::cerr << "Failed to open file: " << fn << std::endl;
-        return;
-    }
-    
-    // Print first few children for debugging
-    std::cout << "First few children in tree " << treeId << ":\n";
-    for (size_t p = 0; p < std::min(size_t(3), total_); ++p) {
-        std::cout << "Node " << PermutationUtils::toKey(perms_[p]) << " has " 
-                 << children[p].size() << " children\n";
+        return false;
     }
     
-    // Write header
-    out << "digraph Tree" << n_ << "_" << treeId << " {\n  rankdir=TB;\n";
-    size_t edgeCount = 0;
+    // Lines go into one large buffer that is flushed with a single write,
+    // or handed to the writer thread while the next one is filled
+    const size_t lineLen = 12 + 2 * size_t(n_);   // '  "<p>" -> "<c>";\n'
+    std::vector<char> buf;
+    if (writer) buf = writer->acquire();
+    buf.reserve(kWriteBuffer + lineLen);
+    std::string header = "digraph Tree" + std::to_string(n_) + "_" + std::to_string(treeId) + " {\n  rankdir=TB;\n";
+    buf.insert(buf.end(), header.begin(), header.end());
     
-    // Write edges
-    for (size_t p = 0; p < total_; ++p) {
-        for (auto c : children[p]) {
-            std::string edge = "  \"" + PermutationUtils::toKey(perms_[p]) + 
-                             "\" -> \"" + PermutationUtils::toKey(perms_[c]) + "\";\n";
-            out << edge;
-            if (!out.good()) {
-                std::cerr << "Error writing edge to file!" << std::endl;
-                return;
+    bool ok = true;
+    for (size_t p = 0; p < total_ && ok; ++p) {
+        const char* pk = keys_.data() + p * n_;
+        for (const uint32_t* c = children.begin(p); c != children.end(p); ++c) {
+            size_t at = buf.size();
+            buf.resize(at + lineLen);
+            char* o = buf.data() + at;
+            std::memcpy(o, "  \"", 3); o += 3;
+            std::memcpy(o, pk, n_); o += n_;
+            std::memcpy(o, "\" -> \"", 6); o += 6;
+            std::memcpy(o, keys_.data() + size_t(*c) * n_, n_); o += n_;
+            std::memcpy(o, "\";\n", 3);
+        }
+        if (buf.size() >= kWriteBuffer) {
+            if (writer) {
+                writer->submit(fd, -1, std::move(buf));
+                buf = writer->acquire();
+            } else {
+                ok = writeAll(fd, buf.data(), buf.size());
+                buf.clear();
             }
-            edgeCount++;
         }
     }
     
     // Write footer
-    out << "}\n";
-    out.close();
+    buf.push_back('}');
+    buf.push_back('\n');
+    if (writer) {
+        writer->submit(fd, -1, std::move(buf));
+        writer->closeAfter(fd);
+        return true;
+    }
+    ok = ok && writeAll(fd, buf.data(), buf.size());
+    close(fd);
+    if (!ok) std::cerr << "Error writing graph to " << fn << std::endl;
+    return ok;
+}
+
+bool TreeBuilder::streamTrees(bool swapCodes, bool resume, AsyncWriter& writer) {
+    const std::string dir = "ist/" + std::to_string(n_);
+    std::filesystem::create_directories(dir);
+    Checkpoint::Layout layout{n_, T_, total_, kStreamBlock, swapCodes};
     
-    std::cout << "Wrote " << edgeCount << " edges to " << fn << std::endl;
+    // Blocks a previous run (serial or MPI, any rank count) finished are kept
+    std::vector<uint8_t> done(layout.blocks(), 0);
+    if (resume) done = Checkpoint::completedBlocks(dir, layout);
+    else Checkpoint::clear(dir);
+    Checkpoint journal(dir, 0, layout);
+    size_t skipped = 0;
+    for (uint8_t d : done) skipped += d;
+    std::cout << "Blocks: " << done.size() << " total, " << skipped << " already complete\n";
     
-    // Verify file was written
-    std::ifstream check(fn);
-    if (check.is_open()) {
-        std::string line;
-        std::getline(check, line);
-        std::cout << "First line of file: " << line << std::endl;
-        check.close();
-    } else {
-        std::cerr << "Could not verify file contents!" << std::endl;
+    // Header first; each block of each tree then lands at its fixed offset
+    std::vector<int> fds(T_, -1);
+    auto closeAll = [&]() {
+        for (int fd : fds)
+            if (fd >= 0) writer.closeAfter(fd);
+    };
+    for (int t = 1; t <= T_; ++t) {
+        std::string fn = IstWriter::path(n_, t);
+        std::cout << "Streaming tree to " << fn << "...\n";
+        int fd = open(fn.c_str(), O_WRONLY | O_CREAT, 0644);
+        IstHeader h = IstHeader::make(n_, t, total_, 0, swapCodes ? kIstSwapCodes : 0);
+        if (fd < 0 || ftruncate(fd, off_t(h.fileSize())) != 0) {
+            std::cerr << "Failed to open file: " << fn << std::endl;
+            if (fd >= 0) close(fd);
+            closeAll();
+            return false;
+        }
+        fds[t-1] = fd;
+        std::vector<char> buf = writer.acquire();
+        buf.assign(reinterpret_cast<const char*>(&h), reinterpret_cast<const char*>(&h) + sizeof(h));
+        writer.submit(fd, 0, std::move(buf));
     }
+    
+    // A block is journaled once its writes are done: after the next block
+    // has been computed, so the writer still overlaps the computation. A
+    // failed write stops the run unjournaled, so --resume redoes the block.
+    std::vector<std::pair<int, uint64_t>> pendingSums;
+    uint64_t pendingBlock = 0;
+    auto retire = [&]() {
+        writer.drain();
+        if (!writer.ok()) {
+            std::cerr << "Writing block " << pendingBlock << " failed; it is not journaled" << std::endl;
+            return false;
+        }
+        for (const auto& ts : pendingSums) journal.record(ts.first, pendingBlock, ts.second);
+        pendingSums.clear();
+        return true;
+    };
+    
+    // Tables hold one block [base_, base_ + kStreamBlock) at a time
+    for (uint64_t blk = 0; blk < layout.blocks(); ++blk) {
+        if (done[blk]) continue;
+        base_ = layout.first(blk);
+        size_t len = layout.last(blk) - base_;         // even: n! and the block are
+        PermutationUtils::permRange(n_, base_, len, perms_);
+        posIndex_.resize(len, n_+1);
+        firstMismatch_.resize(len);
+        initTables();
+        
+        std::vector<std::vector<char>> out(T_);
+        for (int t = 1; t <= T_; ++t) {
+            std::vector<char>& buf = out[t-1];
+            buf = writer.acquire();
+            if (swapCodes) {
+                buf.resize(len / 2);
+                uint8_t q[kBatch];
+                for (size_t i = 0; i < len; i += kBatch) {
+                    size_t m = std::min(kBatch, len - i);
+                    swapPositions(t, base_ + i, m, q);
+                    if (base_ + i == 0) q[0] = SwapCode::kRoot;
+                    for (size_t j = 0; j < m; j += 2)
+                        buf[(i + j) / 2] = char(q[j] | (q[j+1] << 4));
+                }
+            } else {
+                buf.resize(4 * len);
+                parents(t, base_, len, reinterpret_cast<uint32_t*>(buf.data()));
+            }
+        }
+        
+        if (!retire()) {
+            closeAll();
+            return false;
+        }
+        for (int t = 1; t <= T_; ++t) {
+            pendingSums.emplace_back(t, Checkpoint::checksum(out[t-1].data(), out[t-1].size()));
+            writer.submit(fds[t-1], off_t(layout.offset(blk)), std::move(out[t-1]));
+        }
+        pendingBlock = blk;
+    }
+    bool ok = retire();
+    base_ = 0;
+    closeAll();
+    return ok;
+}
+
+bool TreeBuilder::writeBinary(int treeId, const ChildIndex& children, bool swapCodes) const {
+    std::string fn = IstWriter::path(n_, treeId);
+    std::cout << "Writing binary tree to " << fn << "...\n";
+    
+    // The CSR already holds every edge; invert it into the parent array
+    std::vector<uint32_t> parent(total_, kIstNoParent);
+    for (size_t p = 0; p < total_; ++p)
+        for (const uint32_t* c = children.begin(p); c != children.end(p); ++c)
+            parent[*c] = uint32_t(p);
+    if (swapCodes)
+        return IstWriter::writeSwapCodes(fn, n_, treeId, 0, parent.data(), total_);
+    return IstWriter::write(fn, n_, treeId, 0, parent.data(), total_, &children);
 }
 
-std::vector<std::vector<std::vector<uint32_t>>> TreeBuilder::buildTrees() {
+const std::vector<ChildIndex>& TreeBuilder::buildTrees() {
     std::cout << "Building trees for n=" << n_ << " with " << total_ << " permutations\n";
     std::cout << "First few permutations: ";
     for (size_t i = 0; i < std::min(size_t(3), total_); ++i) {
-        std::cout << PermutationUtils::toKey(perms_[i]) << " ";
+        std::cout << PermutationUtils::toKey(perms_.row(i), n_) << " ";
     }
     std::cout << "\n";
     
-    allChildren_.resize(T_, std::vector<std::vector<uint32_t>>(total_));
+    ArenaVector<uint32_t> parent(total_, ArenaAllocator<uint32_t>(&arena_));
+    allChildren_.assign(T_, ChildIndex(&arena_));
     for (int t = 1; t <= T_; ++t) {
         std::cout << "Building tree " << t << "...\n";
-        size_t edgesInTree = 0;
-        for (size_t v = 0; v < total_; ++v) {
-            if (perms_[v] == identity_) {
-                std::cout << "Skipping identity permutation\n";
-                continue;
-            }
-            size_t p = findParent(v, t);
-            allChildren_[t-1][p].push_back(uint32_t(v));
-            edgesInTree++;
-            if (edgesInTree <= 3) {
-                std::cout << "Added edge: " << PermutationUtils::toKey(perms_[p]) 
-                         << " -> " << PermutationUtils::toKey(perms_[v]) << "\n";
-            }
-        }
+        parents(t, 0, total_, parent.data());
+        size_t edgesInTree = total_ - 1;
+        allChildren_[t-1].build(parent.data(), total_, kIstNoParent);
         std::cout << "Tree " << t << " has " << edgesInTree << " edges\n";
     }
     return allChildren_;
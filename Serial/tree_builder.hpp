@@ -2,45 +2,73 @@
 #define TREE_BUILDER_HPP
 
 #include <vector>
+#include <tuple>
 #include <cstdint>
 #include <string>
-#include <unordered_map>
+#include "permutation_utils.hpp"
+#include "child_index.hpp"
+#include "arena.hpp"
+#include "async_writer.hpp"
 
 // Serial construction of n−1 spanning trees on Bₙ
 class TreeBuilder {
 public:
-    explicit TreeBuilder(int n);
-    // Builds all trees and returns children adjacency lists
-    std::vector<std::vector<std::vector<uint32_t>>> buildTrees();
-    const std::vector<std::vector<int>>& getPerms() const { return perms_; }
+    // streaming: build no tables here; only streamTrees may be used.
+    // explicitHugePages: tables from the hugetlbfs pool where it has room
+    explicit TreeBuilder(int n, bool streaming = false, bool explicitHugePages = false);
+    // Builds all trees; returns the CSR children of each tree
+    const std::vector<ChildIndex>& buildTrees();
+    const PermTable& getPerms() const { return perms_; }
 
     const std::vector<std::tuple<int, uint32_t, uint32_t>>& getEdges() const {
         return localEdges_;
     }
-    const std::vector<std::vector<uint32_t>>& getChildren(int t) const {
+    const ChildIndex& getChildren(int t) const {
         return allChildren_[t - 1];
     }
-    std::vector<std::vector<uint32_t>>& getMutableChildren(int t) {
-        return allChildren_[t - 1];
-    }
-    void writeGraph(int treeId, const std::vector<std::vector<uint32_t>>& children) const;
+    // DOT file of every tree, after rendering the key table; with a
+    // writer, buffers are flushed by its thread while the next is formatted.
+    // False when a file failed to open or a direct write failed; queued
+    // writes report through writer->ok()
+    bool writeGraphs(AsyncWriter* writer = nullptr);
+    // Binary .ist file: parent array and CSR children, or 4-bit swap codes;
+    // false when the file could not be written
+    bool writeBinary(int treeId, const ChildIndex& children, bool swapCodes) const;
+    // Out-of-core: fill the tables one vertex block at a time and queue
+    // each block of every tree's .ist parents (or swap codes) on writer.
+    // Finished blocks are journaled; resume skips the ones already done.
+    // False when a file could not be opened or a write failed.
+    bool streamTrees(bool swapCodes, bool resume, AsyncWriter& writer);
+    // Parents in tree t of the vertices [first, first+count), which must be
+    // in the tables; kIstNoParent for the root. Runs kBatch vertices at a time.
+    void parents(int t, size_t first, size_t count, uint32_t* out) const;
 
 private:
     int n_;                                  // permutation length
     size_t total_;                           // n! permutations
     int T_;                                  // number of trees (n−1)
-    std::vector<std::vector<int>> perms_;
-    std::vector<std::vector<int>> posIndex_;
-    std::vector<int> firstMismatch_;
-    std::vector<int> identity_;
-    std::unordered_map<std::string, size_t> indexOf_;
+    size_t base_ = 0;                        // vertex of table row 0
+    Arena arena_;                            // backs every large table below
+    PermTable perms_;                        // all perms, one row each
+    PermTable posIndex_;                     // position lookup, row[sym]
+    ArenaVector<int> firstMismatch_;
+    std::vector<uint8_t> identity_;
     std::vector<std::tuple<int, uint32_t, uint32_t>> localEdges_;
-    std::vector<std::vector<std::vector<uint32_t>>> allChildren_;
+    std::vector<ChildIndex> allChildren_;
+    ArenaVector<char> keys_;                 // key of v at keys_[v*n], no NUL
+
+    static constexpr size_t kWriteBuffer = size_t(4) << 20;
+    static constexpr size_t kStreamBlock = size_t(1) << 20;   // same grid as Parallel
+    bool writeGraph(int treeId, const ChildIndex& children, AsyncWriter* writer) const;
 
     void initTables();
-    std::vector<int> swapAdjacent(size_t, int) const;
-    std::vector<int> fallback(size_t, int) const;
-    size_t findParent(size_t, int) const;
+    // Swap position of the parent in tree t for each of count <= kBatch
+    // vertices from first: p such that swapping p and p+1 yields it
+    static constexpr size_t kBatch = 32;
+    void swapPositions(int t, size_t first, size_t count, uint8_t* out) const;
+    size_t swappedRank(size_t idx, int pos) const {
+        return PermutationUtils::rankAfterSwap(perms_.row(idx - base_), n_, idx, pos);
+    }
 };
 
 #endif // TREE_BUILDER_HPP